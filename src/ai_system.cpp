@@ -3,83 +3,68 @@
 #include <optional>
 #include <SDL_mixer.h>
 #include <world_system.hpp>
-//https://github.com/daancode/a-star
-#include "../ext/pathfinder/AStar.cpp" 
+#include <chrono>
+#include <algorithm>
 // internal
 #include "ai_system.hpp"
 #include "world_init.hpp"
 #include "physics_system.hpp"
 
+using Clock = std::chrono::high_resolution_clock;
+
 const float AGGRO_RANGE = 600.f;
 const float RANGED_STOP_RANGE = 300.f;
 const float ATTRACTOR_RADIUS = 300.f;
 
 const float EPS = 0.1f;
 
+// AISystem::step() job scheduling
+const long long AI_STEP_BUDGET_US = 1000;
+const float ON_SCREEN_URGENCY_MS = 500.f; // On screen enemies go first as if they'd been waiting this much longer
+const float URGENCY_MS_PER_DISTANCE = 0.1f; // And far ones as if they'd waited less, 1 ms per 10 pixels away
+
 inline bool is_close(vec2 a, vec2 b) {
 	return dot(a-b, a-b) < 1000.f;
 }
 
-bool is_target_path_clear(vec2 line_start, vec2 line_end)
-{
-	std::unordered_map<unsigned int, bool> entities_seen; // So that we don't do calculations for polygons multiple times
-	entities_seen.reserve(20);
-	std::vector<Entity> entities_found = SpatialGrid::getInstance().query_ray_cast(line_start, line_end);
-	for (uint i = 0; i < entities_found.size(); i++) {
-		Entity entity_other = entities_found[i];
-		if (entities_seen.count(entity_other) > 0) { continue; } // If the entity exists in the map already, then skip
-		entities_seen[entity_other] = true;
-		Motion& motion_other = registry.motions.get(entity_other);
-		if (motion_other.type_mask == POLYGON_MASK) {
-			ComplexPolygon& polygon = registry.polygons.get(entity_other);
-			if (!polygon.is_only_edge && is_line_polygon_edge_colliding(polygon, line_start, line_end)) {
-				return false;
-			}
-		} else if (motion_other.type_mask == OBSTACLE_MASK) {
-			vec2 is_colliding = is_circle_line_colliding(motion_other.position, motion_other.radius + 10.f, line_start, line_end);
-			if (is_colliding.x != 0.f || is_colliding.y != 0.f) {
-				return false;
-			}
-		}
-	}
-	return true;
-}
-
 //float euclidean_dist(Motion& motion, Motion& other_motion) {
 //	return sqrt(pow(motion.position.x - other_motion.position.x, 2.f) + pow(motion.position.y - other_motion.position.y, 2.f));
 //}
 
+std::vector<ivec2> path_buffer; // Reused by every pathfind_to_target() call
+
 // Sets the moving direction of the src_motion to to pathfind to the target in the current room
 // Source is src_motion.position, target is given position
-void pathfind_to_target(Motion& src_motion, vec2 target_pos) {
+void pathfind_to_target(Entity entity, Motion& src_motion, vec2 target_pos) {
 	
+	Room& room = registry.rooms.components[0];
 	// If possible to go directly to target, do so
-	if (is_target_path_clear(src_motion.position, target_pos)) {
+	if (room.line_of_sight.is_clear(entity, src_motion.position, target_pos)) {
 		src_motion.move_direction = normalize(target_pos - src_motion.position);
 	} else {		
-		AStar::Vec2i target = {
-			(int)(target_pos.x / WorldSystem::TILE_SIZE),
-			(int)(target_pos.y / WorldSystem::TILE_SIZE)
-		};
-		AStar::Vec2i source_pos = {
-			(int)(src_motion.position.x / WorldSystem::TILE_SIZE),
-			(int)(src_motion.position.y / WorldSystem::TILE_SIZE)
-		};
-
-		// Gets the pathfinder generator of the current room
-		AStar::Generator& cur_generator = registry.rooms.components[0].generator;
-		AStar::CoordinateList path = cur_generator.findPath(target, source_pos);
-
-		AStar::Vec2i move_coordinate;
-		if (path.size() >= 2) {
+		ivec2 target = ivec2(target_pos / WorldSystem::TILE_SIZE);
+		ivec2 source_pos = ivec2(src_motion.position / WorldSystem::TILE_SIZE);
+
+		// Gets the pathfinder of the current room
+		Pathfinder& cur_pathfinder = room.pathfinder;
+		ivec2 flow_step;
+		if (cur_pathfinder.get_flow_step(source_pos, target, flow_step)) { // Chasing the player, shared by all chasers
+			if (flow_step != ivec2(0)) {
+				src_motion.move_direction = normalize(vec2(flow_step));
+			} else {
+				src_motion.move_direction = normalize(target_pos - src_motion.position);
+			}
+			return;
+		}
+		cur_pathfinder.find_path(source_pos, target, path_buffer);
+
+		if (path_buffer.size() >= 2) {
 			// Move to the next tile in the path
-			move_coordinate = path[1];
-			vec2 move_dir = { move_coordinate.x - source_pos.x, move_coordinate.y - source_pos.y };
+			vec2 move_dir = vec2(path_buffer[1] - source_pos);
 			src_motion.move_direction = normalize(move_dir);
 		}
 		else {
 			// Go directly to target
-			move_coordinate = path[0];
 			src_motion.move_direction = normalize(target_pos - src_motion.position);
 		}
 	}
@@ -102,7 +87,7 @@ std::optional<Entity> get_closest_attractor(vec2 position) {
 
 // If an attractor is close, move towards it. Otherwise move towards player
 // Return the attractor position
-void pathfind_to_attractor(Motion& src_motion, Entity attractor) {	
+void pathfind_to_attractor(Entity entity, Motion& src_motion, Entity attractor) {	
 
 	// Pathfind to attractor
 	vec2 attractor_position = registry.motions.get(attractor).position;
@@ -118,7 +103,7 @@ void pathfind_to_attractor(Motion& src_motion, Entity attractor) {
 		printf("ate breadcrumb\n");
 		createBreadcrumbEatingEffect((src_motion.position + attractor_position)/2.f);
 	} else {
-		pathfind_to_target(src_motion, attractor_position);
+		pathfind_to_target(entity, src_motion, attractor_position);
 	}
 }
 
@@ -132,7 +117,7 @@ void ratDT(Entity player, vec2 player_position, Entity entity, Enemy& enemy_data
 	auto closest_attractor = get_closest_attractor(motion.position);
 	if (closest_attractor) {
 		registry.spriteSheets.get(entity).set_track(0);
-		pathfind_to_attractor(motion, *closest_attractor);
+		pathfind_to_attractor(entity, motion, *closest_attractor);
 		enemy_data.target = closest_attractor;
 
 		// If interacting with attractor, use idle pose
@@ -143,7 +128,7 @@ void ratDT(Entity player, vec2 player_position, Entity entity, Enemy& enemy_data
 	// If player within range and enemy hp is high, attack
 	else if (length(diff) < AGGRO_RANGE*aggro_range_multiplier) {
 		if (health.current_hp > 0.3 * maxHp) {
-			pathfind_to_target(motion, player_position);
+			pathfind_to_target(entity, motion, player_position);
 			registry.spriteSheets.get(entity).set_track(0);
 			enemy_data.target = player;
 		}
@@ -191,7 +176,7 @@ void wormDT(Entity player, vec2 player_position, Entity entity, Enemy& enemy_dat
 	// If attractor close, go to it
 	auto closest_attractor = get_closest_attractor(motion.position);
 	if (closest_attractor) {
-		pathfind_to_attractor(motion, *closest_attractor);
+		pathfind_to_attractor(entity, motion, *closest_attractor);
 		registry.spriteSheets.get(entity).set_track(0);
 		enemy_data.target = closest_attractor;
 	}
@@ -211,7 +196,7 @@ void wormDT(Entity player, vec2 player_position, Entity entity, Enemy& enemy_dat
 		vec2 diff = player_position - motion.position;
 		// Attack player
 		if (length(diff) < AGGRO_RANGE) {
-			pathfind_to_target(motion, player_position);
+			pathfind_to_target(entity, motion, player_position);
 			registry.spriteSheets.get(entity).set_track(0);
 			enemy_data.target = player;
 		}
@@ -228,7 +213,7 @@ void wormDT(Entity player, vec2 player_position, Entity entity, Enemy& enemy_dat
 
 void snailDT(Entity player, vec2 player_position, Entity enemy, Enemy& enemy_data) {
 	Motion& motion = registry.motions.get(enemy);
-	pathfind_to_target(motion, player_position);
+	pathfind_to_target(enemy, motion, player_position);
 	enemy_data.target = player;
 
 	// Flip sprite if going right
@@ -246,7 +231,7 @@ void squirrelDT(Entity player, vec2 player_position, Entity enemy, Enemy& enemy_
 	// If attractor close, go to it
 	auto closest_attractor = get_closest_attractor(motion.position);
 	if (closest_attractor) {
-		pathfind_to_attractor(motion, *closest_attractor);
+		pathfind_to_attractor(enemy, motion, *closest_attractor);
 		rangedEnemy.can_shoot = false;
 		enemy_data.target = closest_attractor;
 	}
@@ -308,18 +293,18 @@ void bearDT(vec2 player_position, Entity entity, Enemy& enemy_data) {
 
 	auto closest_attractor = get_closest_attractor(motion.position);
 	if (closest_attractor) {
-		pathfind_to_attractor(motion, *closest_attractor);
+		pathfind_to_attractor(entity, motion, *closest_attractor);
 		enemy_data.target = closest_attractor;
 	}
 	else if (!is_hungry) { // not hungry, then chase player
 		if (length(player_position - motion.position) < AGGRO_RANGE) {
-			pathfind_to_target(motion, player_position);
+			pathfind_to_target(entity, motion, player_position);
 			registry.spriteSheets.get(entity).set_track(1);
 		}
 	}
 	else { // if senses food, chase after it
 		motion.max_speed = 100;
-		pathfind_to_target(motion, player_position);
+		pathfind_to_target(entity, motion, player_position);
 		registry.spriteSheets.get(entity).set_track(2);
 	}
 	enemy_data.target = std::nullopt;
@@ -504,7 +489,7 @@ void foxDT(vec2 player_position, Entity entity, Enemy& enemy_data) {
 	// Attack player
 	if (length(diff) < AGGRO_RANGE) {
 		motion.max_speed = 230;
-		pathfind_to_target(motion, player_position);
+		pathfind_to_target(entity, motion, player_position);
 		registry.spriteSheets.get(entity).set_track(1);
 	}
 	// outisde of aggro range, idle
@@ -549,7 +534,7 @@ void alphaWolfDT(vec2 player_position, Entity entity, Enemy& enemy_data) {
 	// in aggro range, runs to player
 	else if (length(diff) < AGGRO_RANGE && enemy_data.howled) {
 		motion.max_speed = 260;
-		pathfind_to_target(motion, player_position);
+		pathfind_to_target(entity, motion, player_position);
 		// random interval: [20000ms, 30000ms]
 		if (howl_interval > (rand() % 10000/5 + 20000/5) && enemy_data.curr_num_of_companions < enemy_data.max_num_of_companions) {
 			enemy_data.howled = false;
@@ -578,13 +563,13 @@ void wolfDT(vec2 player_position, Entity entity, Enemy& enemy_data) {
 	vec2 diff = player_position - motion.position;
 	auto closest_attractor = get_closest_attractor(motion.position);
 	if (closest_attractor) {
-		pathfind_to_attractor(motion, *closest_attractor);
+		pathfind_to_attractor(entity, motion, *closest_attractor);
 		enemy_data.target = closest_attractor;
 	}
 	// in aggro range, runs to player
 	else if (length(diff) < AGGRO_RANGE) {
 		motion.max_speed = 300;
-		pathfind_to_target(motion, player_position);
+		pathfind_to_target(entity, motion, player_position);
 		registry.spriteSheets.get(entity).set_track(1);
 	}
 	// outisde of aggro range, idle
@@ -864,83 +849,144 @@ void AISystem::step(float elapsed_ms)
 	Entity player = registry.players.entities[0];
 	vec2 player_position = registry.motions.get(player).position; // Future: + registry.motions.get(player).sprite_offset;
 	auto& enemies = registry.enemies;
+	// Most enemies chase the player, so they share one flow field instead of each running A*
+	registry.rooms.components[0].pathfinder.set_flow_goal(ivec2(player_position / WorldSystem::TILE_SIZE));
 
+	BBox view_frustum = registry.cameras.components[0].view_frustum;
+	due_jobs.clear();
 	for (int i = 0; i < enemies.components.size(); i++) {
 		Entity entity = enemies.entities[i];
 		Enemy& enemy = enemies.components[i];
 		enemy.next_decision_ms -= elapsed_ms;
 		enemy.next_pathfinding_ms -= elapsed_ms;
 
-		if (enemy.next_decision_ms <= 0) {
-			switch (enemy.type)
-			{
-			case ENEMY_TYPE::SPIDER:
-				ratDT(player, player_position, entity, enemy, 1.2f);
-				break;
-			case ENEMY_TYPE::WORM:
-				wormDT(player, player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::RAT:
-				ratDT(player, player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::SQUIRREL:
-				squirrelDT(player, player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::SNAIL:
-				snailDT(player, player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::BEAR:
-				bearDT(player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::BOAR:
-				boarDT(player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::DEER:
-				deerDT(player_position, entity, player);
-				break;
-			case ENEMY_TYPE::FOX:
-				foxDT(player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::RABBIT:
-				rabbitDT(player_position, entity, player, enemy);
-				break;
-			case ENEMY_TYPE::ALPHAWOLF:
-				alphaWolfDT(player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::WOLF:
-				wolfDT(player_position, entity, enemy);
-				break;
-			case ENEMY_TYPE::WITCH:
-				witchDT(player_position, entity, enemy);
-				break;
-			default:
-				assert(false);
-			}
-			enemy.next_decision_ms += 1000.f;
-			//if (enemy.type != ENEMY_TYPE::WITCH) {
-			//	enemy.next_decision_ms += 1000.f;
-			//}
-			// Decision trees also do pathfinding, so no need to do it again immediately
-			enemy.next_pathfinding_ms = 200.f;
-		}
-		if (enemy.next_pathfinding_ms <= 0 && enemy.target) {
-			// Target may have been removed from game
-			if (registry.motions.has(*enemy.target)) {
-				auto& target_motion = registry.motions.get(*enemy.target);
-				auto& enemy_motion = registry.motions.get(entity);
-				vec2 target_pos = target_motion.position;
-				pathfind_to_target(registry.motions.get(entity), target_pos);
-				if (registry.rangedEnemies.has(entity) && !registry.witches.has(entity)) {
-					registry.renderRequests.get(entity).flip_texture = enemy_motion.look_direction.x > 0;
-				} else {
-					registry.renderRequests.get(entity).flip_texture = enemy_motion.move_direction.x > 0;
-				}
-			} else {
-				enemy.target = std::nullopt;
-			}
-			enemy.next_pathfinding_ms += 200.f;
+		// Decision trees also do pathfinding, so no need to queue both
+		bool is_decision = enemy.next_decision_ms <= 0;
+		if (!is_decision && (enemy.next_pathfinding_ms > 0 || !enemy.target)) { continue; }
+		vec2 position = registry.motions.get(entity).position;
+		float urgency = -((is_decision) ? enemy.next_decision_ms : enemy.next_pathfinding_ms)
+			- length(position - player_position) * URGENCY_MS_PER_DISTANCE;
+		if (position.x > view_frustum.x_low && position.x < view_frustum.x_high
+			&& position.y > view_frustum.y_low && position.y < view_frustum.y_high) {
+			urgency += ON_SCREEN_URGENCY_MS;
+		}
+		due_jobs.push_back({ urgency, entity, is_decision });
+	}
+	std::make_heap(due_jobs.begin(), due_jobs.end(), is_less_urgent);
+
+	// Most jobs start with a line of sight check to their target (the player for decisions), those are all tested up
+	// front in one batch. Jobs deferred to a later step reuse the answer as long as neither end changed tile
+	line_of_sight_queries.clear();
+	for (const AIJob& job : due_jobs) {
+		Enemy& enemy = enemies.get(job.entity);
+		vec2 target_position = player_position;
+		if (!job.is_decision && enemy.target->is_alive() && registry.motions.has(*enemy.target)) {
+			target_position = registry.motions.get(*enemy.target).position;
+		}
+		line_of_sight_queries.push_back({ job.entity, registry.motions.get(job.entity).position, target_position });
+	}
+	registry.rooms.components[0].line_of_sight.answer_batch(line_of_sight_queries);
+
+	auto jobs_start = Clock::now();
+	bool is_any_run = false;
+	while (!due_jobs.empty()) {
+		// The most urgent job always runs so the AI never stalls, the rest wait once the budget is spent
+		if (is_any_run && std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - jobs_start).count()
+			>= AI_STEP_BUDGET_US) {
+			num_deferred_jobs += (uint)due_jobs.size();
+			break;
+		}
+		std::pop_heap(due_jobs.begin(), due_jobs.end(), is_less_urgent);
+		AIJob job = due_jobs.back();
+		due_jobs.pop_back();
+		Enemy* enemy = enemies.find(job.entity); // Looked up again since an earlier job may have removed or added enemies
+		if (!enemy) { continue; }
+		if (job.is_decision) {
+			run_decision(player, player_position, job.entity, *enemy);
+		} else if (enemy->target) { // May have been dropped by an earlier decision
+			run_pathfinding(job.entity, *enemy);
 		}
+		is_any_run = true;
 	}
 }
 
+bool AISystem::is_less_urgent(const AIJob& job1, const AIJob& job2)
+{
+	return job1.urgency < job2.urgency;
+}
+
+void AISystem::run_decision(Entity player, vec2 player_position, Entity entity, Enemy& enemy)
+{
+	// The next decision is due 1000ms from now (decision trees shorten or lengthen that from here). The time this job
+	// was deferred for isn't made up for, otherwise a long deferred enemy would come back due again in a burst
+	enemy.next_decision_ms = max(enemy.next_decision_ms, 0.f);
+	switch (enemy.type)
+	{
+	case ENEMY_TYPE::SPIDER:
+		ratDT(player, player_position, entity, enemy, 1.2f);
+		break;
+	case ENEMY_TYPE::WORM:
+		wormDT(player, player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::RAT:
+		ratDT(player, player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::SQUIRREL:
+		squirrelDT(player, player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::SNAIL:
+		snailDT(player, player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::BEAR:
+		bearDT(player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::BOAR:
+		boarDT(player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::DEER:
+		deerDT(player_position, entity, player);
+		break;
+	case ENEMY_TYPE::FOX:
+		foxDT(player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::RABBIT:
+		rabbitDT(player_position, entity, player, enemy);
+		break;
+	case ENEMY_TYPE::ALPHAWOLF:
+		alphaWolfDT(player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::WOLF:
+		wolfDT(player_position, entity, enemy);
+		break;
+	case ENEMY_TYPE::WITCH:
+		witchDT(player_position, entity, enemy);
+		break;
+	default:
+		assert(false);
+	}
+	enemy.next_decision_ms += 1000.f;
+	//if (enemy.type != ENEMY_TYPE::WITCH) {
+	//	enemy.next_decision_ms += 1000.f;
+	//}
+	// Decision trees also do pathfinding, so no need to do it again immediately
+	enemy.next_pathfinding_ms = 200.f;
+}
 
+void AISystem::run_pathfinding(Entity entity, Enemy& enemy)
+{
+	// Target may have been removed from game (its handle is then stale, even if the index was re-used)
+	if (enemy.target->is_alive() && registry.motions.has(*enemy.target)) {
+		auto& target_motion = registry.motions.get(*enemy.target);
+		auto& enemy_motion = registry.motions.get(entity);
+		vec2 target_pos = target_motion.position;
+		pathfind_to_target(entity, registry.motions.get(entity), target_pos);
+		if (registry.rangedEnemies.has(entity) && !registry.witches.has(entity)) {
+			registry.renderRequests.get(entity).flip_texture = enemy_motion.look_direction.x > 0;
+		} else {
+			registry.renderRequests.get(entity).flip_texture = enemy_motion.move_direction.x > 0;
+		}
+	} else {
+		enemy.target = std::nullopt;
+	}
+	enemy.next_pathfinding_ms = max(enemy.next_pathfinding_ms, 0.f) + 200.f;
+}
@@ -7,8 +7,26 @@
 #include "common.hpp"
 #include "world_init.hpp" // This includes spatial_grid already so don't need to include again?
 
+// Enemies think (run their decision tree, which also pathfinds) and pathfind on their own timers. Instead of running
+// every timer that ran out, a step turns them into jobs and runs the most urgent first until AI_STEP_BUDGET_US is spent.
+// The rest stay due, so a whole wave spawning at once is spread over the next steps. Urgency grows the longer a job
+// waits, and is higher for enemies on screen and near the player
 class AISystem
 {
 public:
 	void step(float elapsed_ms);
+
+	uint num_deferred_jobs = 0; // Jobs pushed to a later step since the last reset, see main.cpp
+
+private:
+	struct AIJob {
+		float urgency;
+		Entity entity;
+		bool is_decision; // Otherwise just pathfinding
+	};
+	std::vector<AIJob> due_jobs; // Max heap on urgency, refilled every step
+	std::vector<LineOfSight::Query> line_of_sight_queries; // One per due job, refilled every step
+	static bool is_less_urgent(const AIJob& job1, const AIJob& job2);
+	void run_decision(Entity player, vec2 player_position, Entity entity, Enemy& enemy);
+	void run_pathfinding(Entity entity, Enemy& enemy);
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #include "animation_system.hpp"
 
 
-void update_texcoord_locs(Entity entity, std::vector<int> track, int num_sprites, int sprite_index)
+void update_texcoord_locs(Entity entity, const SpriteSheetAnimation::Track& track, int num_sprites, int sprite_index)
 {
     RenderRequest& render_request = registry.renderRequests.get(entity);
 
@@ -29,7 +29,7 @@ void AnimationSystem::step(float elapsed_ms)
 
         float& frame_elapsed = animation.frame_elapsed_time;
         frame_elapsed += elapsed_ms;
-        std::vector<int> track = animation.tracks[animation.track_index];
+        const SpriteSheetAnimation::Track& track = animation.tracks[animation.track_index];
         if (frame_elapsed >= animation.track_intervals[animation.track_index]) {
             size_t track_length = track.size();
             
@@ -12,6 +12,7 @@ void CameraSystem::step(float elapsed_ms)
 {
 	Entity entity = registry.cameras.entities[0];
 	Camera& camera = registry.cameras.components[0];
+	camera.last_position = camera.position;
 	if (registry.bezierCurves.has(entity)) {
         auto& curve = registry.bezierCurves.get(entity);
         float& t = curve.t;
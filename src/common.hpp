@@ -6,6 +6,9 @@
 #include <tuple>
 #include <vector>
 #include <optional>
+#include <initializer_list>
+#include <new>
+#include <assert.h>
 
 // glfw (OpenGL)
 #define NOMINMAX
@@ -75,6 +78,69 @@ struct BBox {
 	}
 };
 
+// Fixed capacity vector stored inside the object itself. Components holding one (instead of a std::vector) never touch
+// the heap, so spawning/copying/removing them or clearing a whole room frees nothing. Pushing past N asserts.
+// Only the first size() items are ever constructed, the rest is raw storage (a default constructed Entity would
+// allocate an index)
+template <typename T, unsigned int N>
+class InlineVector {
+	alignas(T) unsigned char storage[N * sizeof(T)];
+	unsigned int count = 0;
+	T* items() { return reinterpret_cast<T*>(storage); }
+	const T* items() const { return reinterpret_cast<const T*>(storage); }
+public:
+	InlineVector() {}
+	InlineVector(std::initializer_list<T> list) {
+		for (const T& item : list) push_back(item);
+	}
+	InlineVector(const InlineVector& other) {
+		for (const T& item : other) push_back(item);
+	}
+	InlineVector& operator=(const InlineVector& other) {
+		if (this != &other) {
+			clear();
+			for (const T& item : other) push_back(item);
+		}
+		return *this;
+	}
+	~InlineVector() { clear(); }
+	template <typename Container> // Any container with begin/end, e.g. std::vector
+	static InlineVector from(const Container& container) {
+		InlineVector result;
+		for (const auto& item : container) result.push_back(item);
+		return result;
+	}
+
+	void push_back(const T& item) {
+		assert(count < N && "InlineVector is full, increase its capacity");
+		if (count < N) new (items() + count++) T(item);
+	}
+	void pop_back() {
+		assert(count > 0);
+		items()[--count].~T();
+	}
+	// Does not keep the order, the last item is moved into the erased spot
+	void erase_swap(unsigned int index) {
+		assert(index < count);
+		items()[index] = items()[count - 1];
+		pop_back();
+	}
+	void clear() {
+		while (count > 0) pop_back();
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	static constexpr size_t capacity() { return N; }
+	T& operator[](size_t i) { assert(i < count); return items()[i]; }
+	const T& operator[](size_t i) const { assert(i < count); return items()[i]; }
+	T& back() { assert(count > 0); return items()[count - 1]; }
+	T* begin() { return items(); }
+	T* end() { return items() + count; }
+	const T* begin() const { return items(); }
+	const T* end() const { return items() + count; }
+};
+
 bool gl_has_errors();
 
 enum class GameState : int {
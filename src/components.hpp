@@ -3,7 +3,8 @@
 #include "common.hpp"
 #include "../ext/stb_image/stb_image.h"
 #include "../ext/rapidjson/document.h"
-#include "../ext/pathfinder/AStar.hpp"
+#include "pathfinder.hpp"
+#include "line_of_sight.hpp"
 
 
 
@@ -320,22 +321,30 @@ struct BezierCurve {
 
 // All data relevant to the shape and motion of entities
 struct Motion {	
+	// Hot fields read every frame by the physics passes, kept together in the first 68 of the 144 bytes. Motions aren't
+	// aligned to cache lines, so this is one or two lines of each rather than three. Rarely used data (like child lists)
+	// lives in the MotionLinks side table
+	vec2 position = { 0,0 };
+	vec2 last_position = { 0,0 }; // Position before this step's integration, used to move children and curves and
+								  // by the renderer to interpolate between steps (see RenderSystem::get_render_position())
+	vec2 velocity = { 0,0 };
+	vec2 move_direction = { 0,0 };
+	float max_speed = 50.f;
+	float accel_rate = 600.f; // Positive constant
+	float friction = 0.7f; // Speed kept per 60 fps frame, see physics_system.cpp. 0 -> 100% dampening, 1 -> no dampening (frictionless)
+	float current_speed = 0;
 	uint32 type_mask = 0; // For optimizing collision tests. Initiliazed to UNCOLLIDABLE_MASK (see world_init.hpp for different types)
 	bool moving = false;
-	bool is_culled = false;
-	vec2 move_direction = { 0,0 };
+	bool is_sleeping = false; // Settled and skipped by the physics step until woken, see Awake
+	ivec2 cell_coords = { INT_MAX, INT_MAX };
+	int cell_index = INT_MAX; // Allows entity to remove itself from it's current Cell
+
 	vec2 look_direction = { 1,0 };
-	vec2 position = { 0,0 };
-	vec2 velocity = { 0,0 };
 	float angular_velocity = 0.f; // In radians/second. Positive spins clockwise, negtive spins ccw
 	float radius = 40.f; // Used for calculating circle-circle collisions between entities
 	bool angled = false;
 	float angle = 0.f;
-	float accel_rate = 600.f; // Positive constant
-	float friction = 0.7f; // Speed Dampening factor. 0 -> 100% dampening, 1 -> no dampening (frictionless)
-	float max_speed = 50.f;
 	float mass = 100.f;
-	float current_speed = 0;
 	vec2 scale = { 1.f,1.f };		// For sprite_offset, we could just have it be the z value of a vec3 position
 	vec2 sprite_offset = { 0,0 }; 	// Moves sprite upwards by a certain amount so the circle collider is at the sprite's feet
 	vec3 sprite_normal = { 0,cos(0.2),sin(0.2) }; // Used for screen tilt and lighting. {0,1,0} faces screen down and {0,0,1} faces up
@@ -344,13 +353,22 @@ struct Motion {
 	float sprite_offset_velocity = 0.f; // 1 dimensional vector, positive means sprite_offset.y will increase (projectiles and particles)
 	float gravity_multiplier = 1.f; // 0 == not affected by gravity, 1 == fully affected, 1 < over affected
 	vec3 forces = { 0,0,0 }; // TODO: Finish
+	
+	// Use reference equality
+	friend bool operator==(const Motion& lhs, const Motion& rhs) {
+		return &lhs == &rhs;
+	}
+	friend bool operator!=(const Motion& lhs, const Motion& rhs) {
+		return &lhs != &rhs;
+	}
+};
 
-	ivec2 cell_coords = { INT_MAX, INT_MAX };
-	int cell_index = INT_MAX; // Allows entity to remove itself from it's current Cell
-	bool checked_collisions = false;
-
+// Side table for the few motions that are attached to others (attack effects following the player etc.)
+// See attachMotionChild / detachMotionChild in world_init.hpp
+struct MotionLinks {
+	static constexpr unsigned int MAX_CHILDREN = 16;
 	// Other motion components that should move with/follow this object
-	std::vector<Entity> children = {};
+	InlineVector<Entity, MAX_CHILDREN> children = {};
 	std::optional<Entity> parent = std::nullopt;
 
 	void add_child(Entity child) {
@@ -359,9 +377,9 @@ struct Motion {
 
 	// Note: This does not reset the child's parent field. This will have to be done manually
 	void remove_child(Entity child) {
-		for (auto it = this->children.begin(); it != this->children.end(); it++) {			
-			if (*it == child) {
-				this->children.erase(it);
+		for (unsigned int i = 0; i < this->children.size(); i++) {
+			if (this->children[i] == child) {
+				this->children.erase_swap(i);
 				return;
 			}
 		}
@@ -369,14 +387,6 @@ struct Motion {
 		// This should never happen.
 		assert(false);
 	}
-	
-	// Use reference equality
-	friend bool operator==(const Motion& lhs, const Motion& rhs) {
-		return &lhs == &rhs;
-	}
-	friend bool operator!=(const Motion& lhs, const Motion& rhs) {
-		return &lhs != &rhs;
-	}
 };
 
 struct Water // For appling effects to entities with water (happens in animation_system)
@@ -538,11 +548,11 @@ struct PointLight // Spherical radius of light held by an entity with a Motion.
 	float intensity = 1.f; // Currently unused
 
 	PointLight() {}
-	PointLight(float radius, float flicker_radius, float entity_id, vec3 diffuse_colour = vec3(255.f, 30.f, 0.f) / 255.f) {
-		this->set_radius(radius, flicker_radius, entity_id);
+	PointLight(float radius, float flicker_radius, Entity entity, vec3 diffuse_colour = vec3(255.f, 30.f, 0.f) / 255.f) {
+		this->set_radius(radius, flicker_radius, entity);
 		diffuse = diffuse_colour;
 	}
-	void set_radius(float _radius, float _flicker_radius, int _entity_id) { // Unfinished, requires tweaking
+	void set_radius(float _radius, float _flicker_radius, Entity _entity) { // Unfinished, requires tweaking
 		this->constant = 4000.f; // 1 / intensity; // Maybe will be constant so move out of here
 		this->linear = 0.02f;
 		this->quadratic = 1.f;
@@ -550,7 +560,7 @@ struct PointLight // Spherical radius of light held by an entity with a Motion.
 		this->radius = _radius;
 		this->flicker_radius = _flicker_radius;
 		this->max_radius = _radius + _flicker_radius;
-		this->entity_id = _entity_id;
+		this->entity_id = (float)_entity.index(); // Index only, the full id (with generation) doesn't fit in a float
 	}
 };
 
@@ -603,11 +613,26 @@ struct Camera
 	float phi_change = 0;
 	float zoom = 3.f;
 	vec2 position = { window_width_px / 2.f, window_height_px / 2.f };
+	vec2 last_position = position; // Position before the last CameraSystem::step, for interpolated rendering
 	vec3 direction = { 0.f,0.f,0.f }; // normalized direction vector (from origin to camera) of the camera
 	vec2 scale_factor = { 1.f, cos(phi) }; // Represents (vertical) scaling of world based on phi
 
 	vec2 frustum_size = vec2(16, 9.2) * 85.f; // 80.f is best
 	BBox view_frustum;
+	std::vector<Entity> visible_entities; // Motions overlapping view_frustum as of the last frame, see CullingSystem
+};
+
+// Motions the physics step simulates, it only iterates this container. Moving motions get it when created. Settled
+// projectiles, particles and pickups lose it (Motion::is_sleeping) and get it back from wake_motion()
+struct Awake
+{
+	float still_ms = 0.f; // How long the motion has been barely moving
+};
+
+// Motions that no spatial structure holds (particles, effects, attacks, anything outside the grid...). Culling can't find
+// them through the SpatialGrid so it tests each of them, see CullingSystem
+struct Unindexed
+{
 };
 
 struct GroundPiece
@@ -660,14 +685,32 @@ struct Edge // Not in registry, just used in the below
 	}
 };
 
+// Edges in SoA form with what the collision tests need precomputed, so they can test several edges at once (see
+// circle_edges_push() in spatial_grid.hpp). StaticColliders keeps the edges of all of a room's polygons in one of these
+struct PolygonEdges
+{
+	std::vector<float> start_x, start_y, end_x, end_y;
+	std::vector<float> unit_x, unit_y; // Direction of the edge
+	std::vector<float> normal_x, normal_y; // Unit, points to the right of the edge
+	std::vector<float> lengths;
+	std::vector<uint8_t> is_collidable;
+
+	uint size() const { return (uint)lengths.size(); }
+	void clear();
+	void push_back(const Edge& edge);
+	void append(const PolygonEdges& other);
+};
+
 struct ComplexPolygon // Counter-clockwise winding order
 {
 	bool is_only_edge = false;
 	bool is_platform = false; // When player is on a platform, they ignore collisions with other non-platform polygons
 	vec2 position = { 0.f, 0.f };
 	std::vector<Edge> world_edges; // In world coordinates as opposed to mesh coordinates
+	PolygonEdges edges; // Built from world_edges, use set_edge_collidable() so the two stay the same
+	BBox bbox = { 0.f, 0.f, 0.f, 0.f };
 	ComplexPolygon(std::vector<Edge> world_edges, vec2 position, bool is_only_edge, bool is_platform) : 
-		world_edges(world_edges), position(position), is_only_edge(is_only_edge), is_platform(is_platform) {}
+		world_edges(world_edges), position(position), is_only_edge(is_only_edge), is_platform(is_platform) { update_edges(); }
 	ComplexPolygon(std::vector<vec2> world_vertices) { // Untested
 		for (uint i = 0; i < world_vertices.size(); i++) {
 			vec2 vertex1 = world_vertices[i];
@@ -675,7 +718,13 @@ struct ComplexPolygon // Counter-clockwise winding order
 			Edge new_edge = { vertex1, vertex2 };
 			this->world_edges.push_back(new_edge);
 		}
+		update_edges();
 	}
+	void set_edge_collidable(uint edge, bool is_collidable) {
+		world_edges[edge].is_collidable = is_collidable;
+		edges.is_collidable[edge] = is_collidable;
+	}
+	void update_edges(); // Rebuilds edges and bbox from world_edges
 };
 
 // Mesh datastructure for storing vertex and index buffers
@@ -692,7 +741,8 @@ struct Mesh
 struct Room
 {
 	static rapidjson::Document loadFromJSONFile(std::string room_file_name);
-	AStar::Generator generator;
+	Pathfinder pathfinder;
+	LineOfSight line_of_sight;
 
 	ivec2 grid_size = { 1,1 };
 	vec2 player_spawn = { 0,0 };
@@ -700,6 +750,7 @@ struct Room
 	int current_wave = 0;
 
 	bool is_render_updated = false;
+	bool is_culling_baked = false; // Set once the CullingSystem has binned this room's props
 };
 
 struct RoomExit {
@@ -1126,12 +1177,17 @@ struct RenderRequest {
 //};
 
 struct SpriteSheetAnimation {
+	static constexpr unsigned int MAX_TRACKS = 6;
+	static constexpr unsigned int MAX_TRACK_FRAMES = 16;
+	typedef InlineVector<int, MAX_TRACK_FRAMES> Track;
+
 	int num_sprites;
 	
 	// List of lists. Each sublist is a list of indexes in the spritesheet which make up an animation
-	std::vector<std::vector<int>> tracks;
+	// Stored inline so copying a generator's animation onto every particle doesn't allocate
+	InlineVector<Track, MAX_TRACKS> tracks;
 	// The interval between each frame in a track. Unique to each track
-	std::vector<float> track_intervals;
+	InlineVector<float, MAX_TRACKS> track_intervals;
 	// Current track ("track" = set of frames that make up an animation)
 	int track_index = 0;
 	// current sprite in current track
@@ -1153,11 +1209,12 @@ struct SpriteSheetAnimation {
 		std::vector<float> track_interval_list
 	)
 		: num_sprites(n_sprites)
-		, tracks(track_list)
-		, track_intervals(track_interval_list)
+		, track_intervals(InlineVector<float, MAX_TRACKS>::from(track_interval_list))
 	{
 		// Make sure that each track has a defined "frame rate"
 		assert(track_list.size() == track_interval_list.size());
+		for (const std::vector<int>& track : track_list)
+			tracks.push_back(Track::from(track));
 	}
 
 	// Pass force=true to reset track stats, even for same animation track
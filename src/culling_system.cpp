@@ -0,0 +1,133 @@
+// internal
+#include "culling_system.hpp"
+#include "job_system.hpp"
+#include "world_init.hpp"
+
+#include <algorithm>
+
+// Grid columns per job
+const uint COLUMN_CHUNK_SIZE = 4;
+
+void CullingSystem::step(BBox new_view_frustum)
+{
+	Room& room = registry.rooms.components[0];
+	if (!room.is_culling_baked) { // The room is fully built by its first frame
+		room.is_culling_baked = true;
+		bake_props();
+	}
+	view_frustum = new_view_frustum;
+
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	min_XY = glm::max(spatial_grid.get_grid_cell_coords({ view_frustum.x_low - margin, view_frustum.y_low - margin }), ivec2(0));
+	max_XY = glm::min(spatial_grid.get_grid_cell_coords({ view_frustum.x_high + margin, view_frustum.y_high + margin }),
+		spatial_grid.grid_size - 1);
+	uint num_columns = (uint)max(max_XY.x - min_XY.x + 1, 0);
+	column_chunks.resize(JobSystem::get_num_chunks(num_columns, COLUMN_CHUNK_SIZE));
+	// The jobs read motions, renderRequests and the grid without locking, nothing else runs while they do
+	JobSystem::getInstance().parallel_for(num_columns, COLUMN_CHUNK_SIZE, [this](uint begin, uint end) {
+		cull_grid_columns(begin, end);
+	});
+
+	render_indices.clear();
+	for (const std::vector<uint>& found : column_chunks) {
+		render_indices.insert(render_indices.end(), found.begin(), found.end());
+	}
+	auto visit_prop = [&](uint prop) {
+		Entity entity = prop_entities[prop];
+		if (Motion* motion = registry.motions.find(entity)) { // May have been removed since the room was baked
+			add_if_visible(entity, *motion, render_indices);
+		}
+	};
+	prop_bins.visit(view_frustum, [this](uint prop) { return prop_bboxes[prop]; }, visit_prop);
+	auto& unindexed_registry = registry.unindexedMotions;
+	for (Entity entity : unindexed_registry.entities) {
+		add_if_visible(entity, registry.motions.get(entity), render_indices);
+	}
+
+	// Coarse and baked entities spanning several chunks of columns are found by each of them
+	std::sort(render_indices.begin(), render_indices.end());
+	render_indices.erase(std::unique(render_indices.begin(), render_indices.end()), render_indices.end());
+
+	// Only copies handles in, Entity() would allocate a new index for each default constructed one
+	std::vector<Entity>& visible_entities = registry.cameras.components[0].visible_entities;
+	visible_entities.clear();
+	for (uint i = 0; i < render_indices.size(); i++) {
+		Entity entity = registry.renderRequests.entities[render_indices[i]];
+		visible_entities.push_back(entity);
+
+		Motion& motion = registry.motions.get(entity);
+		if (!motion.moving && motion.type_mask == OBSTACLE_MASK && motion.scale.y > 150.f) { // If it's a big obstacle
+			obstacle_transparency(entity, motion);											 // Then check obstruction transparency
+		}
+	}
+}
+
+void CullingSystem::cull_grid_columns(uint begin, uint end)
+{
+	std::vector<uint>& found = column_chunks[begin / COLUMN_CHUNK_SIZE];
+	found.clear();
+	SpatialGrid::getInstance().for_each_in_rect({ min_XY.x + (int)begin, min_XY.y }, { min_XY.x + (int)end - 1, max_XY.y },
+		[&](Entity entity) {
+			add_if_visible(entity, registry.motions.get(entity), found);
+		});
+}
+
+void CullingSystem::add_if_visible(Entity entity, const Motion& motion, std::vector<uint>& found)
+{
+	if (!is_bbox_colliding(view_frustum, get_bbox(motion))) { return; }
+	auto& render_registry = registry.renderRequests;
+	if (render_registry.has(entity)) { // Colliders like room bounds aren't drawn
+		found.push_back(render_registry.get_index(entity));
+	}
+}
+
+void CullingSystem::bake_props()
+{
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	prop_entities.clear();
+	prop_bboxes.clear();
+	auto& unindexed_registry = registry.unindexedMotions;
+	for (int i = (int)unindexed_registry.size() - 1; i >= 0; i--) { // Backwards since props are removed on the way
+		Entity entity = unindexed_registry.entities[i];
+		Motion& motion = registry.motions.get(entity);
+		if (motion.type_mask != PROP_MASK || motion.moving) { continue; }
+		prop_entities.push_back(entity);
+		prop_bboxes.push_back(get_bbox(motion));
+		unindexed_registry.remove(entity);
+	}
+	prop_bins.build(spatial_grid.grid_size, (float)spatial_grid.cell_size, prop_bboxes);
+
+	margin = 2.f * spatial_grid.cell_size;
+	auto& motion_registry = registry.motions;
+	for (uint i = 0; i < motion_registry.size(); i++) {
+		Motion& motion = motion_registry.components[i];
+		if (motion.cell_index == INT_MAX) { continue; }
+		vec2 extent = abs(motion.sprite_offset) + abs(motion.scale) / 2.f;
+		margin = max(margin, max(extent.x, extent.y));
+	}
+}
+
+void CullingSystem::obstacle_transparency(Entity entity, Motion& motion)
+{
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	vec2 top_left = motion.position - vec2(motion.scale.x/2.f, motion.scale.y);
+	vec2 bottom_right = motion.position + vec2(motion.scale.x/2.f, 0.f);
+	ivec2 top_left_min_XY = spatial_grid.get_grid_cell_coords(top_left);
+	ivec2 bottom_right_max_XY = spatial_grid.get_grid_cell_coords(bottom_right);
+
+	float transparency_change = -0.05f;
+	spatial_grid.for_each_live_in_rect(top_left_min_XY, bottom_right_max_XY, [&](Entity entity_other) {
+		Motion& motion_other = registry.motions.get(entity_other);
+		if (motion_other.type_mask & (BEING_MASK)) { // motion_other != motion - No need since motion is an obstacle anyways
+			assert(motion_other.type_mask != UNCOLLIDABLE_MASK);
+			if (abs(motion_other.position.x - motion.position.x) < motion.scale.x/2.f + motion_other.scale.x / 2.f
+				&& motion_other.position.y < motion.position.y && motion_other.position.y > top_left.y) {
+				transparency_change *= -1;
+				return false; // Stop the query
+			}
+		}
+		return true;
+	});
+	RenderRequest& render_request = registry.renderRequests.get(entity);
+	render_request.transparency = clamp(render_request.transparency + transparency_change, 0.f, 0.7f);
+}
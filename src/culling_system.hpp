@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.hpp"
+#include "tiny_ecs.hpp"
+#include "components.hpp"
+#include "tiny_ecs_registry.hpp"
+#include "spatial_grid.hpp"
+
+// Finds the motions inside the camera's view frustum so RenderSystem::drawTexturedSprites() only goes through those.
+// Candidates come from the SpatialGrid cells under the frustum (chunks of columns are queried in parallel), from the
+// room's props (binned once per room since they never move) and from the few Unindexed motions. Each candidate is then
+// tested against the frustum exactly. The result is Camera::visible_entities
+class CullingSystem
+{
+public:
+	// Fills Camera::visible_entities in renderRequests order. Run once per frame, after the frame's physics steps and
+	// before drawing
+	void step(BBox view_frustum);
+
+	void obstacle_transparency(Entity entity, Motion& motion);
+
+private:
+	void bake_props(); // Moves the room's props out of unindexedMotions into prop_bins, done once per room
+	void cull_grid_columns(uint begin, uint end); // Job for columns min_XY.x + begin to min_XY.x + end - 1
+	void add_if_visible(Entity entity, const Motion& motion, std::vector<uint>& render_indices);
+
+	BBox view_frustum;
+	ivec2 min_XY = { 0,0 }; // Cells under the frustum plus margin
+	ivec2 max_XY = { -1,-1 };
+	// Grid entities are found by their cell or collider but drawn with their sprite, which sticks out of it by up to this
+	// much (e.g. the top of a tree). Measured when the room is baked, never less than 2 cells
+	float margin = 0.f;
+
+	std::vector<Entity> prop_entities;
+	std::vector<BBox> prop_bboxes; // Parallel to prop_entities
+	StaticBins prop_bins;
+
+	std::vector<std::vector<uint>> column_chunks; // renderRequests indices found by each chunk of columns
+	std::vector<uint> render_indices; // All chunks merged, then sorted with the duplicates removed
+};
@@ -0,0 +1,94 @@
+// internal
+#include "job_system.hpp"
+
+void JobSystem::init(uint num_threads)
+{
+	shutdown();
+	if (num_threads == 0) {
+		num_threads = max(std::thread::hardware_concurrency(), 1u);
+	}
+	for (uint i = 0; i < num_threads; i++) {
+		queues.push_back(std::make_unique<WorkQueue>());
+	}
+	is_stopping = false;
+	for (uint i = 1; i < num_threads; i++) {
+		workers.emplace_back(&JobSystem::worker_loop, this, i);
+	}
+	printf("Job system running on %d threads\n", num_threads);
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		is_stopping = true;
+	}
+	wake_condition.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+	queues.clear();
+}
+
+void JobSystem::submit(void (*function)(void*, uint, uint), void* data, uint count, uint chunk_size, std::atomic<uint>& remaining)
+{
+	num_pending += (int)get_num_chunks(count, chunk_size);
+	uint queue_index = 0;
+	for (uint begin = 0; begin < count; begin += chunk_size) {
+		WorkQueue& queue = *queues[queue_index];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back({ function, data, begin, min(begin + chunk_size, count), &remaining });
+		}
+		queue_index = (queue_index + 1) % queues.size(); // Deal the chunks out round robin, stealing evens out the rest
+	}
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex); // So a worker can't miss the notify between its check and its wait
+	}
+	wake_condition.notify_all();
+}
+
+void JobSystem::wait(std::atomic<uint>& remaining)
+{
+	while (remaining.load(std::memory_order_acquire) > 0) {
+		if (!try_run_job(0)) {
+			std::this_thread::yield(); // The last jobs are already running on the workers
+		}
+	}
+}
+
+bool JobSystem::try_run_job(uint queue_index)
+{
+	Job job;
+	bool is_found = false;
+	for (uint i = 0; i < queues.size() && !is_found; i++) {
+		uint victim_index = (queue_index + i) % queues.size();
+		WorkQueue& queue = *queues[victim_index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) { continue; }
+		if (i == 0) { // Own queue, newest job first since its data is the most likely to still be in cache
+			job = queue.jobs.back();
+			queue.jobs.pop_back();
+		} else { // Steal the oldest
+			job = queue.jobs.front();
+			queue.jobs.pop_front();
+		}
+		is_found = true;
+	}
+	if (!is_found) { return false; }
+	num_pending--;
+	job.function(job.data, job.begin, job.end);
+	job.remaining->fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void JobSystem::worker_loop(uint queue_index)
+{
+	while (true) {
+		if (try_run_job(queue_index)) { continue; }
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		wake_condition.wait(lock, [this]() { return is_stopping || num_pending.load() > 0; });
+		if (is_stopping) { return; }
+	}
+}
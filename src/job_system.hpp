@@ -0,0 +1,84 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// A chunk of a parallel_for, run by whichever thread pops or steals it
+struct Job {
+	void (*function)(void* data, uint begin, uint end);
+	void* data;
+	uint begin;
+	uint end;
+	std::atomic<uint>* remaining; // Jobs of the same parallel_for that haven't finished yet
+};
+
+// Small work-stealing thread pool. Each thread owns a queue: it pops its own jobs from the back and steals from the
+// front of the others' once it runs dry. parallel_for() must only be called from the main thread, which works on its
+// own queue while it waits. Chunk boundaries only depend on count and chunk_size, never on the number of threads, so
+// work that writes its results per chunk and merges them in chunk order gives the same output for any thread count
+class JobSystem
+{
+public:
+	static JobSystem& getInstance()
+	{
+		static JobSystem instance;
+		return instance;
+	}
+
+	void init(uint num_threads = 0); // 0 uses every hardware thread, 1 runs everything inline on the main thread
+	void shutdown();
+	uint get_num_threads() const { return (uint)queues.size(); }
+
+	static uint get_num_chunks(uint count, uint chunk_size) { return (count + chunk_size - 1) / chunk_size; }
+
+	// Calls func(begin, end) for every chunk of [0, count) and returns once all of them are done
+	template <typename Func>
+	void parallel_for(uint count, uint chunk_size, Func&& func);
+
+	JobSystem(JobSystem const&) = delete;
+	void operator=(JobSystem const&) = delete;
+
+private:
+	JobSystem() {}
+	~JobSystem() { shutdown(); }
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+	std::vector<std::unique_ptr<WorkQueue>> queues; // queues[0] belongs to the main thread
+	std::vector<std::thread> workers;
+
+	std::mutex wake_mutex;
+	std::condition_variable wake_condition;
+	std::atomic<int> num_pending{ 0 }; // Jobs pushed but not popped yet, idle workers sleep while this is 0
+	bool is_stopping = false;
+
+	void submit(void (*function)(void*, uint, uint), void* data, uint count, uint chunk_size, std::atomic<uint>& remaining);
+	void wait(std::atomic<uint>& remaining);
+	bool try_run_job(uint queue_index);
+	void worker_loop(uint queue_index);
+};
+
+template <typename Func>
+void JobSystem::parallel_for(uint count, uint chunk_size, Func&& func)
+{
+	using FuncType = std::remove_reference_t<Func>;
+	uint num_chunks = get_num_chunks(count, chunk_size);
+	if (num_chunks <= 1 || queues.size() <= 1) { // Not worth waking anyone up
+		for (uint begin = 0; begin < count; begin += chunk_size) {
+			func(begin, min(begin + chunk_size, count));
+		}
+		return;
+	}
+	std::atomic<uint> remaining(num_chunks);
+	submit([](void* data, uint begin, uint end) { (*(FuncType*)data)(begin, end); }, (void*)&func, count, chunk_size, remaining);
+	wait(remaining);
+}
@@ -112,11 +112,9 @@ void LightingSystem::step(float elapsed_ms) {
 		//std::unordered_map<unsigned int, bool> map_ground_got; // So that we don't have duplicate lights_affecting for ground pieces
 		//map_ground_got.reserve(10);
 
-		std::vector<Entity> entities_found = spatial_grid.query_radius(cell_coords, point_light.max_radius/2.f);
-		for (int j = 0; j < entities_found.size(); j++) {
-			Entity entity_other = entities_found[j];
+		spatial_grid.for_each_in_radius(cell_coords, point_light.max_radius/2.f, [&](Entity entity_other) {
 			Motion& motion = registry.motions.get(entity_other);
-			if (motion.type_mask == 128) continue;
+			if (motion.type_mask == 128) return;
 			RenderRequest& render_request = registry.renderRequests.get(entity_other);
 
 			assert(render_request.num_lights_affecting < 16); // 16 being MAX_POINT_LIGHTS
@@ -133,7 +131,7 @@ void LightingSystem::step(float elapsed_ms) {
 			//	render_request.lights_affecting[render_request.num_lights_affecting] = i;
 			//	render_request.num_lights_affecting += 1; // TODO
 			//}
-		}
+		});
 	}
 }
 
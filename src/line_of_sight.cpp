@@ -0,0 +1,164 @@
+// internal
+#include "line_of_sight.hpp"
+#include "world_init.hpp"
+#include "job_system.hpp"
+
+const float OBSTACLE_CLEARANCE = 10.f; // Lines keep this far from obstacles, so beings fit past them
+const uint BATCH_CHUNK_SIZE = 16; // Lines per job in answer_batch()
+
+void LineOfSight::resize(ivec2 new_grid_size)
+{
+	grid_size = new_grid_size;
+	occluded_cells.assign((uint)(grid_size.x * grid_size.y), 0);
+	mark_occluders_changed();
+}
+
+void LineOfSight::mark_occluders_changed()
+{
+	is_baked = false;
+	occluder_version++; // Every kept answer is stale now
+}
+
+LineOfSight::Answer* LineOfSight::find_answer(Entity asker, vec2 line_start, vec2 line_end)
+{
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	ivec2 start_coords = spatial_grid.get_grid_cell_coords(line_start);
+	ivec2 end_coords = spatial_grid.get_grid_cell_coords(line_end);
+	if (spatial_grid.are_cell_coords_out_of_bounds(start_coords) || spatial_grid.are_cell_coords_out_of_bounds(end_coords)) {
+		return nullptr;
+	}
+	if (asker.index() >= answers.size()) { answers.resize(asker.index() + 1); }
+	Answer& answer = answers[asker.index()];
+	if (answer.occluder_version != occluder_version || answer.start_coords != start_coords || answer.end_coords != end_coords) {
+		answer.occluder_version = occluder_version;
+		answer.start_coords = start_coords;
+		answer.end_coords = end_coords;
+		answer.is_free = is_free_between_cells(start_coords, end_coords);
+		answer.is_tested = false;
+	}
+	return &answer;
+}
+
+bool LineOfSight::is_clear(Entity asker, vec2 line_start, vec2 line_end)
+{
+	num_queries++;
+	Answer* answer = find_answer(asker, line_start, line_end);
+	if (answer && is_known(*answer, line_start, line_end)) {
+		return answer->is_free || answer->is_clear;
+	}
+	num_lines_tested++;
+	bool is_line_clear = is_clear_uncached(line_start, line_end);
+	if (answer) {
+		*answer = { answer->occluder_version, answer->start_coords, answer->end_coords, false, true, line_start, line_end,
+			is_line_clear };
+	}
+	return is_line_clear;
+}
+
+void LineOfSight::answer_batch(const std::vector<Query>& queries)
+{
+	// Answers are found on the main thread, so the jobs only test lines and an asker queried twice is tested once
+	batch_query_indices.clear();
+	for (uint i = 0; i < queries.size(); i++) {
+		const Query& query = queries[i];
+		Answer* answer = find_answer(query.asker, query.line_start, query.line_end);
+		if (!answer || is_known(*answer, query.line_start, query.line_end)) { continue; }
+		answer->is_tested = true;
+		answer->line_start = query.line_start;
+		answer->line_end = query.line_end;
+		batch_query_indices.push_back(i);
+	}
+	num_lines_tested += (uint)batch_query_indices.size();
+	num_lines_batched += (uint)batch_query_indices.size();
+	JobSystem::getInstance().parallel_for((uint)batch_query_indices.size(), BATCH_CHUNK_SIZE, [&](uint begin, uint end) {
+		for (uint i = begin; i < end; i++) {
+			const Query& query = queries[batch_query_indices[i]];
+			answers[query.asker.index()].is_clear = is_clear_uncached(query.line_start, query.line_end);
+		}
+	});
+}
+
+bool LineOfSight::is_free_between_cells(ivec2 start_coords, ivec2 end_coords)
+{
+	if (!is_baked) { // Rooms are built all at once, so this is only redone when an occluder comes or goes
+		bake_occluders();
+		is_baked = true;
+	}
+	// Any line between the two cells stays in the rectangle they span
+	ivec2 min_XY = glm::min(start_coords, end_coords);
+	ivec2 max_XY = glm::max(start_coords, end_coords);
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			if (occluded_cells[X * grid_size.y + Y] != 0) { return false; }
+		}
+	}
+	return true;
+}
+
+bool LineOfSight::is_clear_uncached(vec2 line_start, vec2 line_end)
+{
+	if (!is_baked) { // Rooms are built all at once, so this is only redone when an occluder comes or goes
+		bake_occluders();
+		is_baked = true;
+	}
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	bool is_line_clear = true;
+	auto test_occluder = [&](Entity entity_other) {
+		Motion& motion_other = registry.motions.get(entity_other);
+		if (motion_other.type_mask == POLYGON_MASK) {
+			ComplexPolygon& polygon = registry.polygons.get(entity_other);
+			if (!polygon.is_only_edge && is_line_polygon_edge_colliding(polygon, line_start, line_end)) {
+				is_line_clear = false;
+			}
+		} else if (motion_other.type_mask == OBSTACLE_MASK) {
+			vec2 is_colliding = is_circle_line_colliding(motion_other.position, motion_other.radius + OBSTACLE_CLEARANCE,
+				line_start, line_end);
+			if (is_colliding.x != 0.f || is_colliding.y != 0.f) {
+				is_line_clear = false;
+			}
+		}
+		return is_line_clear; // Stop at the first hit
+	};
+	// A line between two cells on the grid stays on it, and an occluder marks the cell it is in, so only the entities of
+	// occluded cells need a look. A line through none of those is clear
+	if (!spatial_grid.are_cell_coords_out_of_bounds(spatial_grid.get_grid_cell_coords(line_start))
+		&& !spatial_grid.are_cell_coords_out_of_bounds(spatial_grid.get_grid_cell_coords(line_end))) {
+		spatial_grid.for_each_on_ray_in_cells(line_start, line_end, [&](ivec2 cell_coords) {
+			return occluded_cells[cell_coords.x * grid_size.y + cell_coords.y] != 0;
+		}, test_occluder);
+	} else {
+		spatial_grid.for_each_on_ray(line_start, line_end, test_occluder);
+	}
+	return is_line_clear;
+}
+
+void LineOfSight::bake_occluders()
+{
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	std::fill(occluded_cells.begin(), occluded_cells.end(), 0);
+	// A blocked line touches the occluder's bbox (grown by the clearance for obstacles), so marking the cells under that
+	// bbox can only ever send a line to the exact test for nothing, never skip a hit
+	auto mark_bbox = [&](BBox bbox) {
+		ivec2 min_XY = glm::max(spatial_grid.get_grid_cell_coords({ bbox.x_low, bbox.y_low }), ivec2(0));
+		ivec2 max_XY = glm::min(spatial_grid.get_grid_cell_coords({ bbox.x_high, bbox.y_high }), grid_size - 1);
+		for (int X = min_XY.x; X <= max_XY.x; X++) {
+			for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+				occluded_cells[X * grid_size.y + Y] = 1;
+			}
+		}
+	};
+	auto& motion_registry = registry.motions;
+	for (uint i = 0; i < motion_registry.size(); i++) {
+		Motion& motion = motion_registry.components[i];
+		if (motion.type_mask != OBSTACLE_MASK) { continue; }
+		float reach = motion.radius + OBSTACLE_CLEARANCE;
+		mark_bbox(get_bbox(motion.position, vec2(2.f * reach)));
+	}
+	auto& polygon_registry = registry.polygons;
+	for (uint i = 0; i < polygon_registry.size(); i++) {
+		ComplexPolygon& polygon = polygon_registry.components[i];
+		Entity entity = polygon_registry.entities[i];
+		if (polygon.is_only_edge || registry.motions.get(entity).type_mask != POLYGON_MASK) { continue; } // Or removed
+		mark_bbox(polygon.bbox);
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "common.hpp"
+#include "tiny_ecs.hpp"
+
+#include <vector>
+
+// Answers the AI's "can I walk straight there" queries. Only obstacles and solid polygons block a line, and those don't
+// move, so the room keeps a bitmap of the cells any of them could block in: a line through none of those is clear without
+// looking at a single entity. Every asker keeps an answer until one of its ends changes tile or an occluder comes or
+// goes. If the rectangle spanned by the two tiles has no occluded cell, every line between them is clear and the answer
+// holds wherever in those tiles the ends are. Otherwise it only holds for the exact end points it was tested from, so
+// answers are never out of date. AISystem asks for all of a step's due enemies at once with answer_batch(), which tests
+// the lines that need it in parallel before the decision trees run
+class LineOfSight
+{
+public:
+	struct Query {
+		Entity asker;
+		vec2 line_start;
+		vec2 line_end;
+	};
+
+	void resize(ivec2 new_grid_size); // Called when a room is created
+	void mark_occluders_changed(); // An obstacle or solid polygon was added or removed, drops the bitmap and all answers
+
+	bool is_clear(Entity asker, vec2 line_start, vec2 line_end);
+	// Tests every query its asker has no answer for yet, split over the JobSystem
+	void answer_batch(const std::vector<Query>& queries);
+	// Tests the line from its end points, without looking for or keeping an answer
+	bool is_clear_uncached(vec2 line_start, vec2 line_end);
+
+	// Since the last reset, see WorldSystem::update_window()
+	uint num_queries = 0;
+	uint num_lines_tested = 0; // By is_clear() when it had no answer, or by answer_batch()
+	uint num_lines_batched = 0;
+
+private:
+	struct Answer {
+		uint occluder_version = 0; // Stale unless equal to LineOfSight::occluder_version
+		ivec2 start_coords;
+		ivec2 end_coords;
+		bool is_free; // No occluded cell between the two tiles
+		bool is_tested = false; // Otherwise only holds for these end points
+		vec2 line_start;
+		vec2 line_end;
+		bool is_clear;
+	};
+	std::vector<Answer> answers; // By Entity::index() of the asker
+	uint occluder_version = 1;
+
+	ivec2 grid_size = { 0,0 };
+	bool is_baked = false;
+	std::vector<uint8_t> occluded_cells; // Column major like the SpatialGrid, 1 if an occluder could block a line in it
+	std::vector<uint> batch_query_indices; // Scratch for answer_batch(), the queries it has to test
+	void bake_occluders();
+	bool is_free_between_cells(ivec2 start_coords, ivec2 end_coords); // No occluded cell in the rectangle they span
+	// The asker's answer slot, redone if its tiles or the occluders changed. Returns nullptr if an end is off the grid
+	Answer* find_answer(Entity asker, vec2 line_start, vec2 line_end);
+	static bool is_known(const Answer& answer, vec2 line_start, vec2 line_end) {
+		return answer.is_free || (answer.is_tested && answer.line_start == line_start && answer.line_end == line_end);
+	}
+};
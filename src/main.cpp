@@ -18,15 +18,26 @@
 #include "upgrades.hpp"
 #include "camera_system.hpp"
 #include "particle_system.hpp"
+#include "culling_system.hpp"
+#include "job_system.hpp"
 #include "common.hpp"
 
 using Clock = std::chrono::high_resolution_clock;
 
+// The game simulates in fixed steps of FIXED_STEP_MS, as many per frame as the time that passed needs, and the renderer
+// interpolates between the last two steps. Simulation results then don't depend on the frame rate
+const float FIXED_STEP_MS = 1000.f / 120.f;
+// After a long stall, drop time instead of trying to catch up on all of it. Frames are capped at 8 steps (~66ms) where
+// they used to be capped at 20ms, so a hitch up to that long is caught up on instead of slowing the game down. The
+// systems still stepped with a frame's elapsed_ms (lighting, UI, GAME_FROZEN) can see those longer frames too
+const int MAX_STEPS_PER_FRAME = 8;
+
 // Entry point
 int main()
 {
 	// WorldSystem's constructor relies on values initialized here
 	Upgrades::init();
+	JobSystem::getInstance().init(); // Worker threads for the systems' parallel loops, see job_system.hpp
 
 	// Global systems
 	WorldSystem world;
@@ -39,6 +50,7 @@ int main()
 	CameraSystem camera;
 	LightingSystem lighting;
 	ParticleSystem particles;
+	CullingSystem culling;
 
 	// Initializing window
 	GLFWwindow* window = world.create_window();
@@ -53,7 +65,8 @@ int main()
 	renderer.init(window);
 	world.init(&renderer, &ui); // ui init in here, TODO: put this into ui_system
 
-	// variable timestep loop
+	// fixed timestep loop
+	float step_accumulator_ms = 0.f; // Time not simulated yet, always less than FIXED_STEP_MS after the steps of a frame
 	int frame_num = 0;
 	double physics_elapsed = 0; double ai_elapsed = 0; double cpu_elapsed = 0;
 	double total_elapsed = 0; double specific_elapsed = 0; double render_elapsed = 0; double lighting_elapsed = 0;
@@ -75,7 +88,7 @@ int main()
 		auto now = Clock::now();
 		float elapsed_ms = (float)(std::chrono::duration_cast<std::chrono::microseconds>(now - t)).count() / 1000;
 		//if (elapsed_ms > 20.f) { printf("Lag\n"); }
-		elapsed_ms = min(elapsed_ms, 20.f);
+		elapsed_ms = min(elapsed_ms, MAX_STEPS_PER_FRAME * FIXED_STEP_MS);
 		t = now;
 		total_elapsed += elapsed_ms;
 		
@@ -90,35 +103,42 @@ int main()
 		case GameState::IN_GAME:
 			if (!world.is_paused) {
 					auto cpu_start = Clock::now();
+				step_accumulator_ms += elapsed_ms;
+				// A step may leave the game (death, shop, pause), the rest of the time is dropped then
+				while (step_accumulator_ms >= FIXED_STEP_MS && world.get_game_state() == GameState::IN_GAME && !world.is_paused) {
+					step_accumulator_ms -= FIXED_STEP_MS;
+
+						auto ai_start = Clock::now();
+					ai.step(FIXED_STEP_MS);
+						ai_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - ai_start)).count() / 1000;
+
+					world.step(FIXED_STEP_MS);
+
+						auto physics_start = Clock::now();
+					physics.step(FIXED_STEP_MS);
+						physics_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - physics_start)).count() / 1000;
+
+					camera.step(FIXED_STEP_MS);
+
+					// lighting.step() used to be here
 
-					auto ai_start = Clock::now();
-				ai.step(elapsed_ms);
-					ai_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - ai_start)).count() / 1000;
-
-				world.step(elapsed_ms);
-				
-					auto physics_start = Clock::now();
-				physics.step(elapsed_ms);
-					physics_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - physics_start)).count() / 1000;
-				
-				camera.step(elapsed_ms);
-				
-				// lighting.step() used to be here
-
-					//auto specific_start = Clock::now();
-				particles.step(elapsed_ms);
-				spawners.step(elapsed_ms);
-				world.handle_collisions();
-					auto specific_start = Clock::now();
-				animations.step(elapsed_ms);
-					specific_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - specific_start)).count() / 1000;
+					particles.step(FIXED_STEP_MS);
+					spawners.step(FIXED_STEP_MS);
+					world.handle_collisions();
+					registry.commands.flush(); // Apply entity changes recorded by the systems above
+						auto specific_start = Clock::now();
+					animations.step(FIXED_STEP_MS);
+						specific_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - specific_start)).count() / 1000;
+				}
+				step_accumulator_ms = min(step_accumulator_ms, FIXED_STEP_MS);
+				// Only the last step's positions get drawn, so there's no need to cull after every step
+				culling.step(registry.cameras.components[0].view_frustum);
 
 					auto lighting_start = Clock::now();
 				lighting.step(elapsed_ms); // Do lighting after collisions because projectiles with point lights may be deleted by it
 					lighting_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - lighting_start)).count() / 1000;
 
 
-					//specific_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - specific_start)).count() / 1000;
 					cpu_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - cpu_start)).count() / 1000;
 			}
 			break;
@@ -133,7 +153,7 @@ int main()
 		ui.step(elapsed_ms, &world);
 		world.update_window();
 			auto render_start = Clock::now();
-		renderer.draw(world.get_game_state());
+		renderer.draw(world.get_game_state(), step_accumulator_ms / FIXED_STEP_MS);
 			render_frame = (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - render_start)).count() / 1000;
 			render_elapsed += render_frame;
 
@@ -145,12 +165,16 @@ int main()
 		if (false && frame_num % 200 == 0) {
 			printf("CPU Elapsed Avg:	%fms\n", cpu_elapsed / 200.0);
 			printf("Physics Elapsed Avg:	%fms\n", physics_elapsed / 200.0);
+			printf("  Collision Elapsed Avg:	%fms\n", physics.collision_elapsed_ms / 200.0);
 			printf("AI Elapsed Avg:		%fms\n", ai_elapsed / 200.0);
+			printf("  AI Jobs Deferred:	%u\n", ai.num_deferred_jobs);
+			ai.num_deferred_jobs = 0;
 			printf("Lighting Elapsed Avg:	%fms\n", lighting_elapsed / 200.0);
 			printf("Specific Elapsed Avg:	%fms\n", specific_elapsed / 200.0);
 			printf("Render Elapsed Avg:	%fms\n", render_elapsed / 200.0);
 			printf("Total Elapsed Avg:	%fms\n\n", total_elapsed / 200.0);
 			total_elapsed = 0; specific_elapsed = 0; render_elapsed = 0; lighting_elapsed = 0; physics_elapsed = 0; ai_elapsed = 0; cpu_elapsed = 0;
+			physics.collision_elapsed_ms = 0;
 		}
 		frame_num++;
 	}
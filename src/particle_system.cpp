@@ -33,7 +33,7 @@ void ParticleSystem::step(float elapsed_ms) {
 		Particle& particle = particles_registry.components[i];
 		particle.life_remaining_ms -= elapsed_ms;
 		if (particle.life_remaining_ms < 0.f) {
-			registry.remove_all_components_of(entity); // Not in the spatial_grid or anything important so it's fine to delete here
+			registry.commands.destroy(entity); // Not in the spatial_grid or anything important so it's fine to delete at the next flush
 		} else if (particle.life_remaining_ms < 2000.f) {
 			registry.renderRequests.get(entity).transparency += 0.02f; // Fade out when close to being destroyed
 		}
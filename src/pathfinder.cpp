@@ -0,0 +1,473 @@
+// internal
+#include "pathfinder.hpp"
+
+#include <algorithm>
+
+const uint STEP_COST = 10;
+const int CLOSED = -1; // Pathfinder::heap_positions of expanded tiles
+const uint UNREACHED = UINT_MAX; // Pathfinder::flow_distances of tiles with no way to the flow goal
+const ivec2 DIRECTIONS[4] = { { 0, 1 }, { 1, 0 }, { 0, -1 }, { -1, 0 } };
+
+const int CLUSTER_SIZE = 10; // In tiles
+// Runs of free border tiles at least this long get an entrance at each end instead of one in the middle, so paths
+// through wide openings don't all bend towards the middle
+const int ENTRANCE_SPLIT_LENGTH = 6;
+// Paths shorter than this (in tiles, Manhattan) search the tiles directly, they're cheap and come out exact
+const int HIERARCHY_MIN_DISTANCE = 2 * CLUSTER_SIZE;
+
+// Manhattan distance, exact on an open 4 direction grid and never more than the real cost, so tiles are only expanded once
+uint get_heuristic(ivec2 from, ivec2 to)
+{
+	return STEP_COST * (uint)(abs(from.x - to.x) + abs(from.y - to.y));
+}
+
+void Pathfinder::resize(ivec2 new_grid_size)
+{
+	grid_size = new_grid_size;
+	uint num_tiles = (uint)(grid_size.x * grid_size.y);
+	blocker_counts.assign(num_tiles, 0);
+	query_stamps.assign(num_tiles, 0);
+	g_costs.resize(num_tiles);
+	parents.resize(num_tiles);
+	heap_positions.resize(num_tiles);
+	query_stamp = 0;
+	open_heap.reserve(num_tiles);
+	flow_distances.resize(num_tiles);
+	flow_queue.reserve(num_tiles);
+	is_flow_dirty = true;
+
+	num_clusters = (grid_size + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+	uint total_clusters = (uint)(num_clusters.x * num_clusters.y);
+	is_cluster_dirty.assign(total_clusters, true);
+	is_any_cluster_dirty = true;
+	cluster_entrances.assign(total_clusters, {});
+	cluster_costs.assign(total_clusters, {});
+	entrance_slots.assign(num_tiles, -1);
+	start_distances.resize(CLUSTER_SIZE * CLUSTER_SIZE);
+	goal_distances.resize(CLUSTER_SIZE * CLUSTER_SIZE);
+	cluster_queue.reserve(CLUSTER_SIZE * CLUSTER_SIZE);
+	leg_path.reserve(num_tiles);
+}
+
+void Pathfinder::add_collision(ivec2 cell_coords)
+{
+	assert(is_on_grid(cell_coords));
+	uint8_t& blocker_count = blocker_counts[get_tile(cell_coords)];
+	assert(blocker_count < UINT8_MAX);
+	blocker_count++;
+	is_flow_dirty = true;
+	if (blocker_count == 1) { mark_tile_changed(cell_coords); }
+}
+
+void Pathfinder::remove_collision(ivec2 cell_coords)
+{
+	assert(is_on_grid(cell_coords));
+	uint8_t& blocker_count = blocker_counts[get_tile(cell_coords)];
+	if (blocker_count > 0) { // Removing from a free tile does nothing
+		blocker_count--;
+		is_flow_dirty = true;
+		if (blocker_count == 0) { mark_tile_changed(cell_coords); }
+	}
+}
+
+bool Pathfinder::is_blocked(ivec2 cell_coords) const
+{
+	return !is_on_grid(cell_coords) || blocker_counts[get_tile(cell_coords)] > 0;
+}
+
+void Pathfinder::find_path(ivec2 start, ivec2 goal, std::vector<ivec2>& path)
+{
+	path.clear();
+	path.push_back(start);
+	if (!is_on_grid(start) || !is_on_grid(goal) || start == goal) { return; }
+
+	// A blocked start or goal could be left or reached straight across a border, where the hierarchy has no entrance
+	if (get_cluster(start) == get_cluster(goal) || abs(start.x - goal.x) + abs(start.y - goal.y) < HIERARCHY_MIN_DISTANCE
+		|| is_blocked(start) || is_blocked(goal)) {
+		search_tiles(start, goal, path);
+	} else {
+		search_hierarchy(start, goal, path);
+	}
+}
+
+void Pathfinder::search_tiles(ivec2 start, ivec2 goal, std::vector<ivec2>& path)
+{
+	int start_tile = get_tile(start);
+	int goal_tile = get_tile(goal);
+	start_query(start_tile, get_heuristic(start, goal));
+
+	bool is_found = false;
+	while (!open_heap.empty()) {
+		int current_tile = pop_best_tile();
+		if (current_tile == goal_tile) {
+			is_found = true;
+			break;
+		}
+
+		ivec2 current_coords = { current_tile / grid_size.y, current_tile % grid_size.y };
+		uint g_cost = g_costs[current_tile] + STEP_COST;
+		for (ivec2 direction : DIRECTIONS) {
+			ivec2 neighbour_coords = current_coords + direction;
+			if (!is_on_grid(neighbour_coords)) { continue; }
+			int tile = get_tile(neighbour_coords);
+			if (blocker_counts[tile] > 0 && tile != goal_tile) { continue; }
+			reach_tile(tile, g_cost, current_tile, get_heuristic(neighbour_coords, goal));
+		}
+	}
+	if (!is_found) { return; }
+
+	// Walk back from the goal, then flip it so it reads from start to goal
+	uint path_start = (uint)path.size();
+	for (int tile = goal_tile; tile != start_tile; tile = parents[tile]) {
+		path.push_back({ tile / grid_size.y, tile % grid_size.y });
+	}
+	std::reverse(path.begin() + path_start, path.end());
+}
+
+void Pathfinder::search_hierarchy(ivec2 start, ivec2 goal, std::vector<ivec2>& path)
+{
+	if (is_any_cluster_dirty) {
+		rebuild_dirty_clusters();
+		is_any_cluster_dirty = false;
+	}
+	int start_tile = get_tile(start);
+	int goal_tile = get_tile(goal);
+	int start_cluster = get_cluster(start);
+	int goal_cluster = get_cluster(goal);
+	ivec2 start_cluster_min = get_cluster_min(start_cluster);
+	ivec2 goal_cluster_min = get_cluster_min(goal_cluster);
+	int start_cluster_height = get_cluster_max(start_cluster).y - start_cluster_min.y + 1;
+	int goal_cluster_height = get_cluster_max(goal_cluster).y - goal_cluster_min.y + 1;
+	search_cluster(start_tile, start_distances);
+	search_cluster(goal_tile, goal_distances);
+
+	// A* over entrances. The start links to the entrances of its cluster and those of the goal's cluster link to the goal,
+	// with the costs just searched. Leaving a cluster is a single step to the entrance facing it
+	start_query(start_tile, get_heuristic(start, goal));
+	bool is_found = false;
+	while (!open_heap.empty()) {
+		int current_tile = pop_best_tile();
+		if (current_tile == goal_tile) {
+			is_found = true;
+			break;
+		}
+		ivec2 current_coords = { current_tile / grid_size.y, current_tile % grid_size.y };
+		int cluster = get_cluster(current_coords);
+		const std::vector<int>& entrances = cluster_entrances[cluster];
+		uint num_entrances = (uint)entrances.size();
+		uint g_cost = g_costs[current_tile];
+		int slot = entrance_slots[current_tile];
+
+		for (uint i = 0; i < num_entrances; i++) { // Within the cluster
+			ivec2 entrance_coords = { entrances[i] / grid_size.y, entrances[i] % grid_size.y };
+			uint cost = UNREACHED;
+			if (current_tile == start_tile) {
+				ivec2 local_coords = entrance_coords - start_cluster_min;
+				cost = start_distances[local_coords.x * start_cluster_height + local_coords.y];
+			} else if (slot >= 0 && (int)i != slot) {
+				cost = cluster_costs[cluster][slot * num_entrances + i];
+			}
+			if (cost == UNREACHED) { continue; }
+			reach_tile(entrances[i], g_cost + cost, current_tile, get_heuristic(entrance_coords, goal));
+		}
+		if (slot >= 0) { // Across the borders, the start may be an entrance too
+			for (ivec2 direction : DIRECTIONS) {
+				ivec2 neighbour_coords = current_coords + direction;
+				if (!is_on_grid(neighbour_coords) || get_cluster(neighbour_coords) == cluster) { continue; }
+				int tile = get_tile(neighbour_coords);
+				if (entrance_slots[tile] < 0) { continue; }
+				reach_tile(tile, g_cost + STEP_COST, current_tile, get_heuristic(neighbour_coords, goal));
+			}
+		}
+		if (cluster == goal_cluster) {
+			ivec2 local_coords = current_coords - goal_cluster_min;
+			uint cost = goal_distances[local_coords.x * goal_cluster_height + local_coords.y];
+			if (cost != UNREACHED) {
+				reach_tile(goal_tile, g_cost + cost, current_tile, 0);
+			}
+		}
+	}
+	if (!is_found) { return; }
+
+	// Refine leg by leg. Those searches reuse the query arrays, so the entrances are copied out first
+	abstract_path.clear();
+	for (int tile = goal_tile; tile != start_tile; tile = parents[tile]) {
+		abstract_path.push_back(tile);
+	}
+	ivec2 leg_start = start;
+	for (int i = (int)abstract_path.size() - 1; i >= 0; i--) {
+		ivec2 leg_goal = { abstract_path[i] / grid_size.y, abstract_path[i] % grid_size.y };
+		if (abs(leg_goal.x - leg_start.x) + abs(leg_goal.y - leg_start.y) == 1) { // Across a border
+			path.push_back(leg_goal);
+		} else {
+			leg_path.clear();
+			search_tiles(leg_start, leg_goal, leg_path);
+			path.insert(path.end(), leg_path.begin(), leg_path.end());
+		}
+		leg_start = leg_goal;
+	}
+}
+
+void Pathfinder::start_query(int start_tile, uint start_h_cost)
+{
+	query_stamp++;
+	if (query_stamp == 0) { // Wrapped around, so very old stamps could look current
+		std::fill(query_stamps.begin(), query_stamps.end(), 0);
+		query_stamp = 1;
+	}
+	query_stamps[start_tile] = query_stamp;
+	g_costs[start_tile] = 0;
+	parents[start_tile] = -1;
+	open_heap.clear();
+	open_heap.push_back({ start_h_cost, start_h_cost, start_tile });
+	heap_positions[start_tile] = 0;
+}
+
+int Pathfinder::pop_best_tile()
+{
+	int best_tile = open_heap[0].tile;
+	open_heap[0] = open_heap.back();
+	open_heap.pop_back();
+	if (!open_heap.empty()) { sift_down(0); }
+	heap_positions[best_tile] = CLOSED;
+	return best_tile;
+}
+
+void Pathfinder::reach_tile(int tile, uint g_cost, int parent, uint h_cost)
+{
+	if (query_stamps[tile] != query_stamp) { // First time this query reaches the tile
+		query_stamps[tile] = query_stamp;
+		g_costs[tile] = g_cost;
+		parents[tile] = parent;
+		open_heap.push_back({ g_cost + h_cost, h_cost, tile });
+		sift_up((int)open_heap.size() - 1);
+	} else if (heap_positions[tile] != CLOSED && g_cost < g_costs[tile]) { // Shorter way to a tile still open
+		int position = heap_positions[tile];
+		open_heap[position].f_cost -= g_costs[tile] - g_cost;
+		g_costs[tile] = g_cost;
+		parents[tile] = parent;
+		sift_up(position);
+	}
+}
+
+int Pathfinder::get_cluster(ivec2 cell_coords) const
+{
+	return (cell_coords.x / CLUSTER_SIZE) * num_clusters.y + cell_coords.y / CLUSTER_SIZE;
+}
+
+ivec2 Pathfinder::get_cluster_min(int cluster) const
+{
+	return ivec2(cluster / num_clusters.y, cluster % num_clusters.y) * CLUSTER_SIZE;
+}
+
+ivec2 Pathfinder::get_cluster_max(int cluster) const
+{
+	return glm::min(get_cluster_min(cluster) + CLUSTER_SIZE, grid_size) - 1;
+}
+
+void Pathfinder::mark_tile_changed(ivec2 cell_coords)
+{
+	// Entrances on a border depend on the tiles of both sides, so the clusters across any border this tile is on too
+	ivec2 cluster_coords = cell_coords / CLUSTER_SIZE;
+	ivec2 within_cluster = cell_coords % CLUSTER_SIZE;
+	is_cluster_dirty[get_cluster(cell_coords)] = true;
+	is_any_cluster_dirty = true;
+	for (ivec2 direction : DIRECTIONS) {
+		ivec2 neighbour_coords = cluster_coords + direction;
+		if (any(lessThan(neighbour_coords, ivec2(0))) || any(greaterThanEqual(neighbour_coords, num_clusters))) { continue; }
+		ivec2 edge = (direction + 1) / 2 * (CLUSTER_SIZE - 1); // 0 on the low side, CLUSTER_SIZE - 1 on the high side
+		if ((direction.x != 0 && within_cluster.x == edge.x) || (direction.y != 0 && within_cluster.y == edge.y)) {
+			is_cluster_dirty[neighbour_coords.x * num_clusters.y + neighbour_coords.y] = true;
+		}
+	}
+}
+
+void Pathfinder::rebuild_dirty_clusters()
+{
+	for (int cluster = 0; cluster < (int)is_cluster_dirty.size(); cluster++) {
+		if (!is_cluster_dirty[cluster]) { continue; }
+		is_cluster_dirty[cluster] = false;
+		std::vector<int>& entrances = cluster_entrances[cluster];
+		for (int entrance : entrances) {
+			entrance_slots[entrance] = -1;
+		}
+		find_cluster_entrances(cluster, entrances);
+		for (uint i = 0; i < entrances.size(); i++) {
+			entrance_slots[entrances[i]] = (int)i;
+		}
+
+		ivec2 cluster_min = get_cluster_min(cluster);
+		int cluster_height = get_cluster_max(cluster).y - cluster_min.y + 1;
+		uint num_entrances = (uint)entrances.size();
+		std::vector<uint>& costs = cluster_costs[cluster];
+		costs.assign(num_entrances * num_entrances, UNREACHED);
+		for (uint i = 0; i < num_entrances; i++) {
+			search_cluster(entrances[i], start_distances);
+			for (uint j = 0; j < num_entrances; j++) {
+				ivec2 local_coords = ivec2(entrances[j] / grid_size.y, entrances[j] % grid_size.y) - cluster_min;
+				costs[i * num_entrances + j] = start_distances[local_coords.x * cluster_height + local_coords.y];
+			}
+		}
+	}
+}
+
+void Pathfinder::find_cluster_entrances(int cluster, std::vector<int>& entrances)
+{
+	entrances.clear();
+	ivec2 cluster_min = get_cluster_min(cluster);
+	ivec2 cluster_max = get_cluster_max(cluster);
+	for (ivec2 direction : DIRECTIONS) {
+		// Walks this side's border tiles, each facing a tile of the next cluster
+		ivec2 along = { abs(direction.y), abs(direction.x) };
+		ivec2 border_start = { (direction.x > 0) ? cluster_max.x : cluster_min.x, (direction.y > 0) ? cluster_max.y : cluster_min.y };
+		int border_length = (along.x != 0) ? cluster_max.x - cluster_min.x + 1 : cluster_max.y - cluster_min.y + 1;
+		if (!is_on_grid(border_start + direction)) { continue; }
+
+		// Each run of tiles free on both sides gets entrances, the same ones whichever side's cluster finds them
+		int run_start = -1;
+		for (int i = 0; i <= border_length; i++) {
+			bool is_open = i < border_length && !is_blocked(border_start + i * along)
+				&& !is_blocked(border_start + i * along + direction);
+			if (is_open && run_start < 0) {
+				run_start = i;
+			} else if (!is_open && run_start >= 0) {
+				int run_length = i - run_start;
+				if (run_length >= ENTRANCE_SPLIT_LENGTH) {
+					entrances.push_back(get_tile(border_start + run_start * along));
+					entrances.push_back(get_tile(border_start + (i - 1) * along));
+				} else {
+					entrances.push_back(get_tile(border_start + (run_start + run_length / 2) * along));
+				}
+				run_start = -1;
+			}
+		}
+	}
+	// A corner tile can be an entrance on both of its sides
+	std::sort(entrances.begin(), entrances.end());
+	entrances.erase(std::unique(entrances.begin(), entrances.end()), entrances.end());
+}
+
+void Pathfinder::search_cluster(int source_tile, std::vector<uint>& distances)
+{
+	ivec2 source_coords = { source_tile / grid_size.y, source_tile % grid_size.y };
+	int cluster = get_cluster(source_coords);
+	ivec2 cluster_min = get_cluster_min(cluster);
+	ivec2 cluster_max = get_cluster_max(cluster);
+	int cluster_height = cluster_max.y - cluster_min.y + 1;
+	std::fill(distances.begin(), distances.end(), UNREACHED);
+
+	ivec2 local_coords = source_coords - cluster_min;
+	distances[local_coords.x * cluster_height + local_coords.y] = 0;
+	cluster_queue.clear();
+	cluster_queue.push_back(source_tile);
+	for (uint i = 0; i < cluster_queue.size(); i++) {
+		ivec2 current_coords = { cluster_queue[i] / grid_size.y, cluster_queue[i] % grid_size.y };
+		local_coords = current_coords - cluster_min;
+		uint distance = distances[local_coords.x * cluster_height + local_coords.y] + STEP_COST;
+		for (ivec2 direction : DIRECTIONS) {
+			ivec2 neighbour_coords = current_coords + direction;
+			if (any(lessThan(neighbour_coords, cluster_min)) || any(greaterThan(neighbour_coords, cluster_max))) { continue; }
+			int tile = get_tile(neighbour_coords);
+			ivec2 neighbour_local = neighbour_coords - cluster_min;
+			uint& neighbour_distance = distances[neighbour_local.x * cluster_height + neighbour_local.y];
+			if (blocker_counts[tile] > 0 || neighbour_distance != UNREACHED) { continue; }
+			neighbour_distance = distance;
+			cluster_queue.push_back(tile);
+		}
+	}
+}
+
+void Pathfinder::set_flow_goal(ivec2 goal)
+{
+	if (goal != flow_goal) {
+		flow_goal = goal;
+		is_flow_dirty = true;
+	}
+}
+
+bool Pathfinder::get_flow_step(ivec2 from, ivec2 goal, ivec2& step)
+{
+	if (goal != flow_goal) { return false; }
+	if (is_flow_dirty) {
+		build_flow_field();
+		is_flow_dirty = false;
+	}
+	step = { 0,0 };
+	if (!is_on_grid(from)) { return true; }
+
+	// Downhill to the neighbour closest to the goal. A blocked from (e.g. pushed into an obstacle) has no distance of its
+	// own, so any reached neighbour will do
+	uint best_distance = flow_distances[get_tile(from)];
+	for (ivec2 direction : DIRECTIONS) {
+		ivec2 neighbour_coords = from + direction;
+		if (!is_on_grid(neighbour_coords)) { continue; }
+		uint distance = flow_distances[get_tile(neighbour_coords)];
+		if (distance < best_distance) {
+			best_distance = distance;
+			step = direction;
+		}
+	}
+	return true;
+}
+
+void Pathfinder::build_flow_field()
+{
+	std::fill(flow_distances.begin(), flow_distances.end(), UNREACHED);
+	if (!is_on_grid(flow_goal)) { return; }
+
+	// Like find_path(), the goal itself may be blocked
+	int goal_tile = get_tile(flow_goal);
+	flow_distances[goal_tile] = 0;
+	flow_queue.clear();
+	flow_queue.push_back(goal_tile);
+	for (uint i = 0; i < flow_queue.size(); i++) {
+		int current_tile = flow_queue[i];
+		ivec2 current_coords = { current_tile / grid_size.y, current_tile % grid_size.y };
+		uint distance = flow_distances[current_tile] + 1;
+		for (ivec2 direction : DIRECTIONS) {
+			ivec2 neighbour_coords = current_coords + direction;
+			if (!is_on_grid(neighbour_coords)) { continue; }
+			int tile = get_tile(neighbour_coords);
+			if (blocker_counts[tile] > 0 || flow_distances[tile] != UNREACHED) { continue; }
+			flow_distances[tile] = distance;
+			flow_queue.push_back(tile);
+		}
+	}
+}
+
+bool Pathfinder::is_better(const OpenTile& open_tile1, const OpenTile& open_tile2)
+{
+	return open_tile1.f_cost < open_tile2.f_cost
+		|| (open_tile1.f_cost == open_tile2.f_cost && open_tile1.h_cost < open_tile2.h_cost);
+}
+
+void Pathfinder::sift_up(int position)
+{
+	OpenTile open_tile = open_heap[position];
+	while (position > 0) {
+		int parent = (position - 1) / 2;
+		if (!is_better(open_tile, open_heap[parent])) { break; }
+		open_heap[position] = open_heap[parent];
+		heap_positions[open_heap[position].tile] = position;
+		position = parent;
+	}
+	open_heap[position] = open_tile;
+	heap_positions[open_tile.tile] = position;
+}
+
+void Pathfinder::sift_down(int position)
+{
+	OpenTile open_tile = open_heap[position];
+	int size = (int)open_heap.size();
+	while (true) {
+		int child = 2 * position + 1;
+		if (child >= size) { break; }
+		if (child + 1 < size && is_better(open_heap[child + 1], open_heap[child])) { child++; }
+		if (!is_better(open_heap[child], open_tile)) { break; }
+		open_heap[position] = open_heap[child];
+		heap_positions[open_heap[position].tile] = position;
+		position = child;
+	}
+	open_heap[position] = open_tile;
+	heap_positions[open_tile.tile] = position;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "common.hpp"
+
+#include <vector>
+
+// A* over the tiles of a room (4 directions, each step costs the same). Every per-tile array is flat, column major like
+// the SpatialGrid and sized once by resize(). The open set is a binary heap that also knows where each tile sits in it
+// so a better path just moves the tile up. Arrays are stamped with the query they belong to instead of being cleared,
+// so find_path() allocates nothing once path has grown big enough.
+// Long paths go through a hierarchy (HPA*) instead: the room is split into square clusters, and the free tiles facing
+// each other across a cluster border are entrances. Each cluster knows the cost between its entrances, so a long path is
+// an A* over entrances, refined into tiles leg by leg. Clusters are rebuilt lazily, only those that had a tile blocked
+// or freed since
+class Pathfinder
+{
+public:
+	void resize(ivec2 new_grid_size); // Called when a room is created. Also clears all collisions
+
+	// A tile is blocked while at least one collider covers it. Adds and removes must be paired, like the obstacles and
+	// platforms of createComplexPolygon() do
+	void add_collision(ivec2 cell_coords);
+	void remove_collision(ivec2 cell_coords);
+	bool is_blocked(ivec2 cell_coords) const;
+
+	// Fills path (cleared first) with the tiles from start to goal, both included. The start and goal tiles may be
+	// blocked themselves. Just { start } if the goal can't be reached, or is off the grid. Paths through the hierarchy
+	// can be a little longer than the shortest one
+	void find_path(ivec2 start, ivec2 goal, std::vector<ivec2>& path);
+
+	// Flow field: the distance of every tile to one shared goal, so anything heading there reads its next step instead of
+	// running its own find_path(). Rebuilt lazily, only once the goal changes tile or a collision is added or removed
+	void set_flow_goal(ivec2 goal);
+	// False if goal isn't the flow goal (use find_path() then). Otherwise step is the direction of the next tile towards
+	// it, { 0,0 } if from is the goal or can't reach it
+	bool get_flow_step(ivec2 from, ivec2 goal, ivec2& step);
+
+private:
+	ivec2 grid_size = { 0,0 };
+	std::vector<uint8_t> blocker_counts; // Occupancy, colliders covering each tile
+
+	int get_tile(ivec2 cell_coords) const { return cell_coords.x * grid_size.y + cell_coords.y; }
+	bool is_on_grid(ivec2 cell_coords) const {
+		return cell_coords.x >= 0 && cell_coords.y >= 0 && cell_coords.x < grid_size.x && cell_coords.y < grid_size.y;
+	}
+
+	// Per tile, only valid when query_stamps[tile] == query_stamp
+	std::vector<uint> query_stamps;
+	std::vector<uint> g_costs;
+	std::vector<int> parents;
+	std::vector<int> heap_positions; // Index in open_heap, CLOSED once expanded
+	uint query_stamp = 0;
+
+	struct OpenTile {
+		uint f_cost; // g + h
+		uint h_cost; // Ties go to the tile closest to the goal
+		int tile;
+	};
+	std::vector<OpenTile> open_heap;
+	static bool is_better(const OpenTile& open_tile1, const OpenTile& open_tile2);
+	void sift_up(int position);
+	void sift_down(int position);
+	void start_query(int start_tile, uint start_h_cost);
+	int pop_best_tile(); // Marks it CLOSED
+	void reach_tile(int tile, uint g_cost, int parent, uint h_cost); // Opens the tile or lowers its cost, unless CLOSED
+	void search_tiles(ivec2 start, ivec2 goal, std::vector<ivec2>& path);
+
+	// Hierarchy
+	ivec2 num_clusters = { 0,0 };
+	std::vector<bool> is_cluster_dirty; // Cluster tiles (or the tiles facing them) blocked or freed since it was built
+	bool is_any_cluster_dirty = false;
+	std::vector<std::vector<int>> cluster_entrances; // Entrance tiles per cluster
+	std::vector<std::vector<uint>> cluster_costs; // Per cluster, entrance to entrance costs within it, row major
+	std::vector<int> entrance_slots; // Per tile, its index in its cluster's entrances, -1 if it isn't one
+	std::vector<uint> start_distances; // Costs within the start's cluster, by tile within the cluster
+	std::vector<uint> goal_distances;
+	std::vector<int> cluster_queue;
+	std::vector<int> abstract_path; // Tiles of the entrances a hierarchical path goes through, goal first
+	std::vector<ivec2> leg_path;
+
+	int get_cluster(ivec2 cell_coords) const;
+	ivec2 get_cluster_min(int cluster) const;
+	ivec2 get_cluster_max(int cluster) const;
+	void mark_tile_changed(ivec2 cell_coords);
+	void rebuild_dirty_clusters();
+	void find_cluster_entrances(int cluster, std::vector<int>& entrances);
+	// Breadth first from source within its cluster. The source may be blocked. distances is by tile within the cluster
+	void search_cluster(int source_tile, std::vector<uint>& distances);
+	void search_hierarchy(ivec2 start, ivec2 goal, std::vector<ivec2>& path);
+
+	ivec2 flow_goal = { -1,-1 };
+	bool is_flow_dirty = true;
+	std::vector<uint> flow_distances; // Steps to flow_goal per tile, UNREACHED if blocked or cut off
+	std::vector<int> flow_queue; // Breadth first frontier, every step costs the same so that's Dijkstra
+	void build_flow_field();
+};
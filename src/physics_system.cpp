@@ -2,8 +2,27 @@
 #include "physics_system.hpp"
 #include "render_system.hpp"
 #include "world_init.hpp"
+#include "job_system.hpp"
+
+#include <chrono>
+
+using Clock = std::chrono::high_resolution_clock;
 
 SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+JobSystem& job_system = JobSystem::getInstance();
+
+// Motions/pairs per job. Multiples of 8 so are_circles_colliding() batches line up the same as in a single call
+const uint MOTION_CHUNK_SIZE = 256;
+const uint PAIR_CHUNK_SIZE = 512;
+
+// Motions of these types are put to sleep once they've barely moved for SLEEP_DELAY_MS, see update_sleep()
+const uint32 SLEEPABLE_MASK = PROJECTILE_MASK | PARTICLE_MASK | PICKUPABLE_MASK;
+const float SLEEP_SPEED = 5.f;
+const float SLEEP_DELAY_MS = 500.f;
+
+// Motion::friction was tuned as the velocity kept per frame at 60 fps, when physics stepped once per frame. Steps of any
+// other length keep friction^(step_ms / FRICTION_STEP_MS), so a motion slows down the same at any step rate
+const float FRICTION_STEP_MS = 1000.f / 60.f;
 
 bool is_hitting_ground(Entity entity, Motion& motion) {
 	if (motion.sprite_offset.y > -motion.scale.y / 2.f) { // If hit the ground
@@ -12,9 +31,7 @@ bool is_hitting_ground(Entity entity, Motion& motion) {
 			if (!registry.tempEffects.has(entity)) {
 				bool landed_in_water = false;
 				ivec2 cell_coords = spatial_grid.get_grid_cell_coords(motion.position); // Can't use motion.cell_coords because particles don't have
-				std::vector<Entity> entities_found = spatial_grid.query_radius(cell_coords, 0.f);
-				for (int i = 0; i < entities_found.size(); i++) {
-					Entity entity_other = entities_found[i];
+				spatial_grid.for_each_in_radius(cell_coords, 0.f, [&](Entity entity_other) {
 					Motion& motion_other = registry.motions.get(entity_other);
 					if (motion_other.type_mask == POLYGON_MASK) {
 						ComplexPolygon& polygon = registry.polygons.get(entity_other);
@@ -22,7 +39,7 @@ bool is_hitting_ground(Entity entity, Motion& motion) {
 							if (is_point_within_polygon(polygon, motion.position)) {
 								if (polygon.is_platform) {
 									landed_in_water = false;
-									break;
+									return false; // Stop the query
 								}
 								else {
 									landed_in_water = true;
@@ -30,7 +47,8 @@ bool is_hitting_ground(Entity entity, Motion& motion) {
 							}
 						}
 					}
-				}
+					return true;
+				});
 				if (landed_in_water) {
 					//printf("ok\n");
 					should_bounce = false;
@@ -65,6 +83,98 @@ bool is_hitting_ground(Entity entity, Motion& motion) {
 	return false;
 }
 
+// Tight first pass that only touches the hot fields at the front of Motion (see components.hpp)
+// Every awake motion is integrated here, motions following a BezierCurve are then overwritten by advance_curves()
+// The others keep last_position == position (see update_sleep()), so they're drawn where they are without being visited
+// Motions are independent of each other here so chunks of them are integrated in parallel
+void integrate_motions(float step_seconds, vec2 room_size, float clamp_inset)
+{
+	auto& motion_registry = registry.motions;
+	const Entity* awake_entities = registry.awakeMotions.entities.data();
+	uint size = (uint)registry.awakeMotions.size();
+	vec2 min_clamp = { clamp_inset, clamp_inset };
+	vec2 max_clamp = room_size - clamp_inset;
+
+	job_system.parallel_for(size, MOTION_CHUNK_SIZE, [&](uint begin, uint end) {
+		for (uint i = begin; i < end; i++) {
+			Motion& motion = motion_registry.get_known(awake_entities[i]); // Awake is only ever given to motions
+			motion.last_position = motion.position;
+			if (!motion.moving) { continue; }
+			motion.position += motion.velocity * step_seconds; // Update position first for better collisions
+			if (motion.type_mask & BEING_MASK) {
+				motion.position = clamp(motion.position, min_clamp, max_clamp);
+			}
+		}
+	});
+}
+
+// Moves the (few) motions that are on a BezierCurve. Iterates backwards since finished curves are removed
+void advance_curves(float elapsed_ms, float step_seconds)
+{
+	auto& curve_registry = registry.bezierCurves;
+	for (int i = (int)curve_registry.size() - 1; i >= 0; i--) {
+		Entity entity = curve_registry.entities[i];
+		Motion* motion_ptr = registry.motions.find(entity);
+		if (!motion_ptr || !motion_ptr->moving) { continue; } // Camera curves are handled by the CameraSystem
+		Motion& motion = *motion_ptr;
+		vec2 old_position = motion.last_position;
+		motion.position = old_position; // Undo the integrate pass, curves set the position themselves
+
+		BezierCurve& curve = curve_registry.components[i];
+		float& t = curve.t;
+		if (t < 1) {
+			t += elapsed_ms / curve.curve_duration_ms;
+			vec4 time = {t*t*t, t*t, t, 1};
+			motion.position = time * curve.basis;
+
+			motion.move_direction = normalize(motion.position - old_position);
+			//motion.sprite_offset = curve.default_sprite_offset;
+		} else if (curve.has_more_joints()) {
+			curve.joint_next_point();
+		} else {
+			curve_registry.remove(entity);
+			motion.velocity = (motion.position - old_position) / step_seconds;
+		}
+	}
+}
+
+// Settled projectiles, particles and pickups are put to sleep: they stop being iterated until wake_motion()
+void PhysicsSystem::update_sleep(Entity entity, Motion& motion, Awake& awake, float elapsed_ms)
+{
+	if (motion.moving) { // Otherwise it was stopped (e.g. by is_hitting_ground()) and can sleep right away
+		bool is_still = (motion.type_mask & SLEEPABLE_MASK) && motion.current_speed < SLEEP_SPEED
+			&& motion.sprite_offset_velocity == 0.f && length(motion.move_direction) == 0.f && !registry.bezierCurves.has(entity);
+		awake.still_ms = (is_still) ? awake.still_ms + elapsed_ms : 0.f;
+		if (awake.still_ms < SLEEP_DELAY_MS) { return; }
+	}
+	motion.moving = false;
+	motion.is_sleeping = true;
+	spatial_grid.count_sleeping(motion, 1);
+	motion.velocity = { 0.f, 0.f };
+	motion.current_speed = 0.f;
+	registry.awakeMotions.remove(entity);
+	// Not integrated anymore, so nothing would catch last_position up. Same for the children it stops moving
+	motion.last_position = motion.position;
+	if (MotionLinks* links = registry.motionLinks.find(entity)) {
+		for (Entity child : links->children) {
+			if (Motion* child_motion = registry.motions.find(child)) {
+				child_motion->last_position = child_motion->position;
+			}
+		}
+	}
+}
+
+void wake_motion(Entity entity)
+{
+	Motion& motion = registry.motions.get(entity);
+	if (!motion.is_sleeping) { return; } // Already awake, or static and never meant to move
+	motion.is_sleeping = false;
+	spatial_grid.count_sleeping(motion, -1);
+	motion.moving = true;
+	registry.awakeMotions.emplace(entity);
+}
+
+
 void PhysicsSystem::step(float elapsed_ms) 
 {
 	float step_seconds = elapsed_ms / 1000.f;
@@ -78,40 +188,18 @@ void PhysicsSystem::step(float elapsed_ms)
 	Camera& camera = registry.cameras.components[0];
 	camera.view_frustum = get_bbox(camera.position, camera.frustum_size / camera.scale_factor);
 
-	for(uint i = 0; i < motion_registry.size(); i++)
-	{
-		Motion& motion = motion_registry.components[i];
-		Entity entity = motion_registry.entities[i];
+	integrate_motions(step_seconds, { room_width, room_height }, clamp_inset);
+	advance_curves(elapsed_ms, step_seconds);
 
-		motion.is_culled = !is_bbox_colliding(camera.view_frustum, get_bbox(motion));
+	// Only awake motions are simulated. Iterates backwards since the ones that settle are put to sleep (removed) on the way
+	auto& awake_registry = registry.awakeMotions;
+	for (int i = (int)awake_registry.size() - 1; i >= 0; i--)
+	{
+		Entity entity = awake_registry.entities[i];
+		Motion& motion = motion_registry.get(entity);
 
 		if (motion.moving) {
-			vec2 old_position = motion.position;
-			if (registry.bezierCurves.has(entity)) {
-				auto& curve = registry.bezierCurves.get(entity);
-				float& t = curve.t;
-				if (t < 1) {
-					// NOTE: Will bug out of framerate low
-					t += elapsed_ms / curve.curve_duration_ms;
-					vec4 time = {t*t*t, t*t, t, 1};
-					motion.position = time * curve.basis;
-
-					motion.move_direction = normalize(motion.position - old_position);
-					//motion.sprite_offset = curve.default_sprite_offset;
-				} else if (curve.has_more_joints()) {
-					curve.joint_next_point();
-				} else {
-					registry.bezierCurves.remove(entity);
-					motion.velocity = (motion.position - old_position) / step_seconds;
-				}
-			}	
-			else {
-				motion.position += motion.velocity * step_seconds; // Update position first for better collisions
-				if (motion.type_mask & BEING_MASK) {
-					motion.position.x = clamp(motion.position.x, clamp_inset, room_width - clamp_inset);
-					motion.position.y = clamp(motion.position.y, clamp_inset, room_height - clamp_inset);
-				}
-			}
+			vec2 old_position = motion.last_position;
 
 			if (length(motion.move_direction) > 0.f) {
 				vec2 move_dir_unit = normalize(motion.move_direction);
@@ -131,7 +219,7 @@ void PhysicsSystem::step(float elapsed_ms)
 					motion.current_speed = motion.max_speed;
 				}
 			} else if (length(motion.velocity) > 0.f) { // decel so velocity approaches 0 
-				motion.velocity *= motion.friction;
+				motion.velocity *= pow(motion.friction, step_seconds * 1000.f / FRICTION_STEP_MS);
 				motion.current_speed = length(motion.velocity);
 				if (motion.current_speed < 1.f) {
 					motion.velocity = { 0.f, 0.f };
@@ -149,13 +237,17 @@ void PhysicsSystem::step(float elapsed_ms)
 				motion.sprite_offset += vec2(0, -motion.sprite_offset_velocity * step_seconds);
 			}
 
-			// Move children equally
+			// Move children equally. They're never awake themselves, so their last_position is kept here for interpolation
 			vec2 d_pos = motion.position - old_position;
-			for (Entity child : motion.children) {
-				if (!registry.motions.has(child)) {
-//					assert(registry.motions.has(child));
-				} else {
-					registry.motions.get(child).position += d_pos;
+			if (MotionLinks* links = registry.motionLinks.find(entity)) {
+				for (Entity child : links->children) {
+					if (!registry.motions.has(child)) {
+//						assert(registry.motions.has(child));
+					} else {
+						Motion& child_motion = registry.motions.get(child);
+						child_motion.last_position = child_motion.position;
+						child_motion.position += d_pos;
+					}
 				}
 			}
 
@@ -167,13 +259,16 @@ void PhysicsSystem::step(float elapsed_ms)
 			}
 			
 			if (motion.cell_index != INT_MAX) { // If the current motion exists in the spatial_grid
-				moving_check_collisions(entity, motion);
 				update_motion_cells(entity, motion);
 			}
-		} else if (!motion.is_culled && motion.type_mask == OBSTACLE_MASK && motion.scale.y > 150.f) { // If it's a big obstacle
-			obstacle_transparency(entity, motion);													   // Then check obstruction transparency
 		}
+		update_sleep(entity, motion, awake_registry.components[i], elapsed_ms);
 	}
+	auto collision_start = Clock::now();
+	find_collision_pairs();
+	resolve_collision_pairs();
+	collision_elapsed_ms += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - collision_start)).count() / 1000;
+
 	Entity player = registry.players.entities[0];
 	Motion& motion = registry.motions.get(player);
 	if (length(motion.move_direction) > 0.f) {
@@ -186,7 +281,24 @@ void PhysicsSystem::step(float elapsed_ms)
 }
 
 
-void motions_push(Motion& motion1, Motion& motion2) // Make two motions push each other
+void obstacle_push(Motion& motion, vec2 obstacle_position, float obstacle_radius) // Obstacles themselves never move
+{
+	vec2 separation_vec = obstacle_position - motion.position;
+	float separation_distance = length(separation_vec);
+	float combined_radius = (motion.radius + obstacle_radius);
+
+	if (separation_distance > 0.f) {
+		vec2 separation_unit = normalize(separation_vec);
+		float push_extra = (1.f - separation_distance / combined_radius) * 100.f;
+		float dot_product1 = max(dot(motion.velocity, separation_unit), 0.f);
+		float p = 2.f * (dot_product1) / (3.f);
+		motion.velocity = motion.velocity - p * (2.f * separation_unit - 1.f * separation_unit) - separation_unit * push_extra;
+	}
+}
+
+// Velocity change of motion1 per unit of motion2's mass (and the opposite for motion2) when two motions push each other
+// Only reads positions and radii. Returns false if they are exactly on top of each other and so can't push
+bool get_push_velocity(const Motion& motion1, const Motion& motion2, vec2& push_velocity)
 {
 	vec2 separation_vec = motion2.position - motion1.position;
 	float separation_distance = length(separation_vec);
@@ -195,50 +307,63 @@ void motions_push(Motion& motion1, Motion& motion2) // Make two motions push eac
 
 	if (separation_distance > 0.f) {
 		vec2 separation_unit = normalize(separation_vec);
-		if (motion2.type_mask != OBSTACLE_MASK) { // motion2 will always be entity_other and is thus what we check
-			motion1.velocity += -separation_unit * push_strength * motion2.mass;
-			motion2.velocity -= -separation_unit * push_strength * motion1.mass;
-		}
-		else { // Colliding with an obstacle
-			float push_extra = (1.f - separation_distance / combined_radius) * 100.f;
-			float dot_product1 = max(dot(motion1.velocity, separation_unit), 0.f);
-			float p = 2.f * (dot_product1) / (3.f);
-			motion1.velocity = motion1.velocity - p * (2.f * separation_unit - 1.f * separation_unit) - separation_unit * push_extra;
-		}
+		push_velocity = -separation_unit * push_strength;
+		return true;
 	}
+	return false;
 }
 
-bool is_motions_colliding(const Motion& motion_i, const Motion& motion_j, uint32 combined_type_mask)
+void motions_push(Motion& motion1, Motion& motion2) // Make two motions push each other
+{
+	if (motion2.type_mask == OBSTACLE_MASK) { // motion2 will always be entity_other and is thus what we check
+		obstacle_push(motion1, motion2.position, motion2.radius);
+		return;
+	}
+	vec2 push_velocity;
+	if (get_push_velocity(motion1, motion2, push_velocity)) {
+		motion1.velocity += push_velocity * motion2.mass;
+		motion2.velocity -= push_velocity * motion1.mass;
+	}
+}
+
+// Circle test radius factor for each type combination, 0 if the combination never collides
+float collision_radius_factor(uint32 combined_type_mask)
 {
-	bool is_colliding = false;
 	switch (combined_type_mask & ~PLAYER_MASK) // Ignore the possible PLAYER_MASK
 	{
 	case (BEING_MASK | BEING_MASK): // in handle_collisons: entity = being, entity_other = character
-		//if (motion_j.type_mask & PLAYER_MASK) { index1 = i; index2 = j; } // Ugly but necessary (ensure entity1 is player)
-		is_colliding = is_circle_colliding(motion_i, motion_j, 0.7f);
-		break;
+		return 0.7f;
 	case (BEING_MASK | OBSTACLE_MASK): // in handle_collisons: entity = being, entity_other = obstacle
-		is_colliding = is_circle_colliding(motion_i, motion_j);
-		break;
-	case (BEING_MASK | PICKUPABLE_MASK):
-		is_colliding = is_circle_colliding(motion_i, motion_j); // Maybe make this a 'special BBox collide'
-		break;
+	case (BEING_MASK | PICKUPABLE_MASK): // Maybe make this a 'special BBox collide'
 	case (BEING_MASK | PROJECTILE_MASK): // in handle_collisons: entity = being, entity_other = projectile
+	case (OBSTACLE_MASK | PROJECTILE_MASK): // in handle_collisons: entity = obstacle, entity_other = projectile
+		return 1.f;
+	case (BEING_MASK | DOOR_MASK):
+		return 0.8f;
+	}
+	return 0.f;
+}
+
+// Conditions other than the circles overlapping
+bool is_collision_possible(const Motion& motion_i, const Motion& motion_j, uint32 combined_type_mask)
+{
+	switch (combined_type_mask & ~PLAYER_MASK)
+	{
+	case (BEING_MASK | PROJECTILE_MASK):
 		{
 			float projectile_vertical_offset = (motion_i.type_mask == PROJECTILE_MASK) ? motion_i.sprite_offset.y : motion_j.sprite_offset.y;
-			if (abs(projectile_vertical_offset) < 100.f) {
-				is_colliding = is_circle_colliding(motion_i, motion_j); // Maybe make this a 'special BBox collide'
-			}
+			return abs(projectile_vertical_offset) < 100.f;
 		}
-		break;
 	case (BEING_MASK | DOOR_MASK): // Must check that it is the player and not an enemy:
-		if (combined_type_mask & PLAYER_MASK) { is_colliding = is_circle_colliding(motion_i, motion_j, 0.8f); }
-		break;
-	case (OBSTACLE_MASK | PROJECTILE_MASK): // in handle_collisons: entity = obstacle, entity_other = projectile
-		is_colliding = is_circle_colliding(motion_i, motion_j); // Maybe make this a 'special BBox collide'
-		break;
+		return (combined_type_mask & PLAYER_MASK) != 0;
 	}
-	return is_colliding;
+	return collision_radius_factor(combined_type_mask) > 0.f;
+}
+
+bool is_motions_colliding(const Motion& motion_i, const Motion& motion_j, uint32 combined_type_mask)
+{
+	return is_collision_possible(motion_i, motion_j, combined_type_mask)
+		&& is_circle_colliding(motion_i, motion_j, collision_radius_factor(combined_type_mask));
 }
 
 void PhysicsSystem::update_motion_cells(Entity entity, Motion& motion)
@@ -253,114 +378,303 @@ void PhysicsSystem::update_motion_cells(Entity entity, Motion& motion)
 	if (old_cell_coords != motion.cell_coords) {
 		spatial_grid.remove_entity_from_cell(old_cell_coords, motion.cell_index, entity);
 		motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, entity);
+		// Wake whatever is asleep in the cell it moved into (not itself, it's awake)
+		Cell& cell = spatial_grid.get_cell(motion.cell_coords);
+		for (uint i = 0; i < cell.entities.size() && cell.num_sleeping > 0; i++) {
+			if (registry.motions.get(cell.entities[i]).is_sleeping) {
+				wake_motion(cell.entities[i]);
+			}
+		}
 	}
-	motion.checked_collisions = false;
 }
 
-void PhysicsSystem::moving_check_collisions(Entity entity, Motion& motion)
+// Broadphase: every moving (so awake) motion in the grid queries the cells its circle overlaps. Both motions of a moving pair
+// (and a polygon found in several cells) are found more than once, so the pairs are sorted by a key made of both
+// entities and duplicates dropped. Each potentially colliding pair is then in collision_pairs exactly once.
+// The baked static colliders are queried separately, straight from their packed arrays. Moving projectiles don't query
+// where they ended up but sweep their whole path, see sweep_projectile().
+// Only reads the grid and the motions, so chunks of motions are queried in parallel into their own BroadphaseChunk
+void PhysicsSystem::find_collision_pairs()
 {
-	// TODO: Are multiple collisions being added between entities?
-	std::vector<Entity> obstacles_colliding; // Must do being-obstacle collision resolution after being-being
-
-	vec2 radius_change = { motion.radius, motion.radius };
-	ivec2 top_left_min_XY = spatial_grid.get_grid_cell_coords(motion.position - radius_change);
-	ivec2 bottom_right_max_XY = spatial_grid.get_grid_cell_coords(motion.position + radius_change);
-
-	//std::vector<Entity> entities_found = spatial_grid.query_radius(motion.cell_coords, motion.radius);
-	std::vector<Entity> entities_found = spatial_grid.query_rect(top_left_min_XY, bottom_right_max_XY);
-	// First do dynamic-dynamic collisions
-	for (int i = 0; i < entities_found.size(); i++) {
-		Entity entity_other = entities_found[i];
-		Motion& motion_other = registry.motions.get(entity_other);
-		if (motion_other != motion) {
-			assert(motion_other.type_mask != UNCOLLIDABLE_MASK);
-			if (motion_other.checked_collisions) { continue; }
-
-			uint32 combined_type_mask = motion.type_mask | motion_other.type_mask;
-			if ((combined_type_mask & ~PLAYER_MASK) == (BEING_MASK | POLYGON_MASK)) {
-				obstacles_colliding.push_back(entity_other);
+	const StaticColliders& statics = spatial_grid.static_colliders;
+	auto& motion_registry = registry.motions;
+	auto& awake_registry = registry.awakeMotions;
+	uint size = (uint)awake_registry.size();
+	broadphase_chunks.resize(max(JobSystem::get_num_chunks(size, MOTION_CHUNK_SIZE), (uint)broadphase_chunks.size()));
+
+	job_system.parallel_for(size, MOTION_CHUNK_SIZE, [&](uint begin, uint end) {
+		BroadphaseChunk& chunk = broadphase_chunks[begin / MOTION_CHUNK_SIZE];
+		chunk.collision_pairs.clear();
+		chunk.static_pairs.clear();
+		chunk.direct_collisions.clear();
+		for (uint i = begin; i < end; i++) {
+			Entity entity = awake_registry.entities[i];
+			Motion& motion = motion_registry.get(entity);
+			if (!motion.moving || motion.cell_index == INT_MAX) { continue; } // Only moving motions in the spatial_grid
+			if (motion.type_mask == PROJECTILE_MASK) { // Instead of only testing where they ended up
+				sweep_projectile(entity, motion, chunk);
 				continue;
 			}
-			if (is_motions_colliding(motion, motion_other, combined_type_mask)) {
-				if ((combined_type_mask & ~PLAYER_MASK) == (BEING_MASK | OBSTACLE_MASK)) {
-					obstacles_colliding.push_back(entity_other);
-				} else if ((combined_type_mask & ~PLAYER_MASK) == BEING_MASK) {
-					if (registry.enemies.has(entity) && registry.enemies.has(entity_other)) { // WHOLE THING IS HACKY
-						if (registry.enemies.get(entity).collision_immune && registry.enemies.get(entity).collision_immune) {
-							// TODO: ADJUST WOLF COLLISIONS SO NOT PERFECTLY OVERLAPPING?
-						}   // Do not push entity if entity has knock-back immune
-						else if (!registry.enemies.has(entity_other) || !registry.enemies.get(entity_other).knock_back_immune) {
-							motions_push(motion, motion_other);
-						}
-					} else {
-						motions_push(motion, motion_other);
-					}
+
+			vec2 radius_change = { motion.radius, motion.radius };
+			ivec2 top_left_min_XY = spatial_grid.get_grid_cell_coords(motion.position - radius_change);
+			ivec2 bottom_right_max_XY = spatial_grid.get_grid_cell_coords(motion.position + radius_change);
+			spatial_grid.for_each_live_in_rect(top_left_min_XY, bottom_right_max_XY, [&](Entity entity_other) {
+				if (entity_other == entity) { return; }
+				unsigned int id = entity, id_other = entity_other;
+				uint64_t key = (id < id_other) ? ((uint64_t)id << 32 | id_other) : ((uint64_t)id_other << 32 | id);
+				chunk.collision_pairs.push_back({ key, entity, entity_other });
+			});
+
+			if ((motion.type_mask & ~PLAYER_MASK) != BEING_MASK) { continue; } // Nothing else hits static colliders
+			BBox circle_bbox = { motion.position.x - motion.radius, motion.position.x + motion.radius,
+				motion.position.y - motion.radius, motion.position.y + motion.radius };
+			statics.for_each_circle(circle_bbox, [&](uint circle) {
+				if (!is_circle_colliding(motion.position, motion.radius, statics.circle_positions[circle], statics.circle_radii[circle])) {
+					return;
 				}
-				Entity entity1 = (motion_other.type_mask > motion.type_mask) ? entity : entity_other;
-				Entity entity2 = (motion_other.type_mask > motion.type_mask) ? entity_other : entity;
-				registry.collisions.emplace_with_duplicates(entity1, entity2, combined_type_mask); // Must be duplicates
-			}
+				Entity entity_other = statics.circle_entities[circle];
+				chunk.static_pairs.push_back({ entity, entity_other, OBSTACLE_MASK, (int)circle });
+				Entity entity1 = (OBSTACLE_MASK > motion.type_mask) ? entity : entity_other;
+				Entity entity2 = (OBSTACLE_MASK > motion.type_mask) ? entity_other : entity;
+				chunk.direct_collisions.push_back({ entity1, entity2, motion.type_mask | OBSTACLE_MASK });
+			});
+			statics.for_each_polygon(circle_bbox, [&](uint polygon) {
+				chunk.static_pairs.push_back({ entity, statics.polygon_entities[polygon], POLYGON_MASK, (int)polygon });
+			});
+		}
+	});
+
+	collision_pairs.clear();
+	static_pairs.clear();
+	for (uint c = 0; c < JobSystem::get_num_chunks(size, MOTION_CHUNK_SIZE); c++) {
+		BroadphaseChunk& chunk = broadphase_chunks[c];
+		collision_pairs.insert(collision_pairs.end(), chunk.collision_pairs.begin(), chunk.collision_pairs.end());
+		static_pairs.insert(static_pairs.end(), chunk.static_pairs.begin(), chunk.static_pairs.end());
+		for (const DirectCollision& collision : chunk.direct_collisions) { // The registry isn't thread safe
+			registry.collisions.emplace_with_duplicates(collision.entity1, collision.entity2, collision.combined_type_mask);
 		}
 	}
-	// Last do dynamic-static collisions
-	vec2 polygon_push_velocity = {0.f, 0.f};
-	bool is_testing_platforms = false;
-	for (int i = 0; i < obstacles_colliding.size(); i++) {
-		Entity entity_other = obstacles_colliding[i];
-		Motion motion_other = registry.motions.get(entity_other);
-		if (motion_other.type_mask == POLYGON_MASK) {
-			ComplexPolygon& polygon = registry.polygons.get(entity_other);
-			if (is_testing_platforms) {
-				if (polygon.is_platform) {
-					motion.velocity += is_circle_polygon_edge_colliding(polygon, motion);
-				}
-			} else {
-				vec2 push_velocity = is_circle_polygon_edge_colliding(polygon, motion);
+	// Sorting by the moving entity as well makes which of a moving-moving pair is kept deterministic
+	std::sort(collision_pairs.begin(), collision_pairs.end(), [](const CollisionPair& p1, const CollisionPair& p2) {
+		return p1.key < p2.key || (p1.key == p2.key && (unsigned int)Entity(p1.entity) < (unsigned int)Entity(p2.entity));
+	});
+	collision_pairs.erase(std::unique(collision_pairs.begin(), collision_pairs.end(), [](const CollisionPair& p1, const CollisionPair& p2) {
+		return p1.key == p2.key;
+	}), collision_pairs.end());
+}
 
-				if (polygon.is_platform) {
-					if (is_point_within_polygon(polygon, motion.position)) {
-						is_testing_platforms = true;
-						motion.velocity -= polygon_push_velocity;
-					}
-				}
-				polygon_push_velocity += push_velocity;
-				motion.velocity += push_velocity;
-			}
-		} else {
-			motions_push(motion, motion_other);
+// Whether hitting entity_other ends a projectile's path, see WorldSystem::handle_collisions(). Trees and furniture destroy
+// it, beings other than its owner use up one of its hits_left
+bool is_projectile_stopped(const Projectile& projectile, Entity entity_other, uint32 other_type_mask, int& hits_left)
+{
+	if (other_type_mask == OBSTACLE_MASK) {
+		OBSTACLE_TYPE type = registry.obstacles.get(entity_other).type;
+		return type == OBSTACLE_TYPE::TREE || type == OBSTACLE_TYPE::FURNITURE;
+	}
+	if ((other_type_mask & BEING_MASK) && entity_other != projectile.owner) {
+		return --hits_left <= 0;
+	}
+	return false;
+}
+
+// Continuous collision detection for projectiles, small and fast enough to skip past beings and obstacles between two
+// steps. The projectile's circle is swept from last_position to position against the other circles (also moving, so
+// relative to them). Every new contact on the way is a hit, in the order they happen, up to the one that stops the
+// projectile (only the first for one that's destroyed on impact). Plus anything it was already overlapping and still is
+// (e.g. an enemy it pierces), same as testing the end position alone would find
+void PhysicsSystem::sweep_projectile(Entity entity, const Motion& motion, BroadphaseChunk& chunk)
+{
+	vec2 displacement = motion.position - motion.last_position;
+	std::vector<SweptHit>& hits = chunk.swept_hits;
+	hits.clear();
+	spatial_grid.for_each_on_swept_circle(motion.last_position, motion.position, motion.radius, [&](Entity entity_other) {
+		if (entity_other == entity) { return; }
+		const Motion& motion_other = registry.motions.get(entity_other);
+		uint32 combined_type_mask = motion.type_mask | motion_other.type_mask;
+		float radius_factor = collision_radius_factor(combined_type_mask);
+		if (radius_factor == 0.f || !is_collision_possible(motion, motion_other, combined_type_mask)) { return; }
+
+		vec2 other_start = (motion_other.moving) ? motion_other.last_position : motion_other.position;
+		float t = get_time_of_impact(motion.last_position, displacement - (motion_other.position - other_start), other_start,
+			(motion.radius + motion_other.radius) * radius_factor);
+		if (t >= 0.f) {
+			hits.push_back({ t, entity_other });
+		} else if (is_circle_colliding(motion, motion_other, radius_factor)) {
+			Entity entity1 = (motion_other.type_mask > motion.type_mask) ? entity : entity_other;
+			Entity entity2 = (motion_other.type_mask > motion.type_mask) ? entity_other : entity;
+			chunk.direct_collisions.push_back({ entity1, entity2, combined_type_mask });
 		}
+	});
+	// Ties are broken by entity so the order doesn't depend on how the grid was walked
+	std::sort(hits.begin(), hits.end(), [](const SweptHit& h1, const SweptHit& h2) {
+		return h1.time < h2.time || (h1.time == h2.time && (unsigned int)Entity(h1.entity_other) < (unsigned int)Entity(h2.entity_other));
+	});
+	Projectile* projectile = registry.projectiles.find(entity);
+	int hits_left = (projectile) ? projectile->hits_left : 1;
+	for (const SweptHit& hit : hits) {
+		uint32 other_type_mask = registry.motions.get(hit.entity_other).type_mask;
+		Entity entity1 = (other_type_mask > motion.type_mask) ? entity : hit.entity_other;
+		Entity entity2 = (other_type_mask > motion.type_mask) ? hit.entity_other : entity;
+		chunk.direct_collisions.push_back({ entity1, entity2, motion.type_mask | other_type_mask });
+		if (!projectile || is_projectile_stopped(*projectile, hit.entity_other, other_type_mask, hits_left)) { break; }
 	}
 }
 
-void PhysicsSystem::obstacle_transparency(Entity entity, Motion& motion)
+// Whether entity pushes entity_other (and is pushed back) when it's the one checking their collision
+bool is_being_pushing(Entity entity, Entity entity_other)
 {
-	vec2 top_left = motion.position - vec2(motion.scale.x/2.f, motion.scale.y);
-	vec2 bottom_right = motion.position + vec2(motion.scale.x/2.f, 0.f);
-	ivec2 top_left_min_XY = spatial_grid.get_grid_cell_coords(top_left);
-	ivec2 bottom_right_max_XY = spatial_grid.get_grid_cell_coords(bottom_right);
-
-	std::vector<Entity> entities_found = spatial_grid.query_rect(top_left_min_XY, bottom_right_max_XY);
-	float transparency_change = -0.05f;
-	for (int i = 0; i < entities_found.size(); i++) {
-		Entity entity_other = entities_found[i];
+	if (registry.enemies.has(entity) && registry.enemies.has(entity_other)) { // WHOLE THING IS HACKY
+		if (registry.enemies.get(entity).collision_immune && registry.enemies.get(entity).collision_immune) {
+			// TODO: ADJUST WOLF COLLISIONS SO NOT PERFECTLY OVERLAPPING?
+			return false;
+		}   // Do not push entity if entity has knock-back immune
+		else if (registry.enemies.get(entity_other).knock_back_immune) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Narrowphase over the pairs from find_collision_pairs(). 'entity' of each pair is always a moving motion
+// Positions don't change in here, so everything that only depends on them (circle tests, being-being pushes) is
+// computed in parallel first. The pushes are then added in pair order by a serial pass, exactly like doing it all
+// serially would, and the static collisions of different moving entities are independent so they run in parallel last
+void PhysicsSystem::resolve_collision_pairs()
+{
+	// Gather the circles of every pair into lanes and test them all at once, see is_motions_colliding()
+	CircleLanes& lanes = circle_lanes;
+	uint num_pairs = (uint)collision_pairs.size();
+	lanes.resize(num_pairs);
+	job_system.parallel_for(num_pairs, PAIR_CHUNK_SIZE, [&](uint begin, uint end) {
+		for (uint i = begin; i < end; i++) {
+			const Motion& motion = registry.motions.get(collision_pairs[i].entity);
+			const Motion& motion_other = registry.motions.get(collision_pairs[i].entity_other);
+			float radius_factor = collision_radius_factor(motion.type_mask | motion_other.type_mask);
+			lanes.x1[i] = motion.position.x; lanes.y1[i] = motion.position.y;
+			lanes.x2[i] = motion_other.position.x; lanes.y2[i] = motion_other.position.y;
+			lanes.combined_radii[i] = motion.radius * radius_factor + motion_other.radius * radius_factor;
+		}
+		are_circles_colliding(end - begin, &lanes.x1[begin], &lanes.y1[begin], &lanes.x2[begin], &lanes.y2[begin],
+			&lanes.combined_radii[begin], &lanes.is_colliding[begin]);
+		for (uint i = begin; i < end; i++) {
+			lanes.is_pushing[i] = false;
+			if (!lanes.is_colliding[i]) { continue; }
+			const Motion& motion = registry.motions.get(collision_pairs[i].entity);
+			const Motion& motion_other = registry.motions.get(collision_pairs[i].entity_other);
+			if (((motion.type_mask | motion_other.type_mask) & ~PLAYER_MASK) == BEING_MASK) {
+				lanes.is_pushing[i] = get_push_velocity(motion, motion_other, lanes.push_velocities[i]);
+			}
+		}
+	});
+
+	// static_pairs already holds the baked ones. Must do being-obstacle collision resolution after being-being
+	for (uint i = 0; i < num_pairs; i++) {
+		Entity entity = collision_pairs[i].entity;
+		Entity entity_other = collision_pairs[i].entity_other;
+		Motion& motion = registry.motions.get(entity);
 		Motion& motion_other = registry.motions.get(entity_other);
-		if (motion_other.type_mask & (BEING_MASK)) { // motion_other != motion - No need since motion is an obstacle anyways
-			assert(motion_other.type_mask != UNCOLLIDABLE_MASK);
-			if (abs(motion_other.position.x - motion.position.x) < motion.scale.x/2.f + motion_other.scale.x / 2.f
-				&& motion_other.position.y < motion.position.y && motion_other.position.y > top_left.y) {
-				transparency_change *= -1;
-				break;
+		assert(motion_other.type_mask != UNCOLLIDABLE_MASK);
+
+		uint32 combined_type_mask = motion.type_mask | motion_other.type_mask;
+		if ((combined_type_mask & PROJECTILE_MASK) && ((motion.type_mask == PROJECTILE_MASK) ? motion : motion_other).moving) {
+			continue; // Found by sweep_projectile() already
+		}
+		if ((combined_type_mask & ~PLAYER_MASK) == (BEING_MASK | POLYGON_MASK)) {
+			static_pairs.push_back({ entity, entity_other, POLYGON_MASK, -1 });
+			continue;
+		}
+		if (lanes.is_colliding[i] && is_collision_possible(motion, motion_other, combined_type_mask)) {
+			if ((combined_type_mask & ~PLAYER_MASK) == (BEING_MASK | OBSTACLE_MASK)) {
+				static_pairs.push_back({ entity, entity_other, OBSTACLE_MASK, -1 });
+			} else if ((combined_type_mask & ~PLAYER_MASK) == BEING_MASK) {
+				// Each moving being used to check its own collisions, so a pair of moving beings pushed each other once from
+				// each side. The pair is only resolved once now, so the push is applied for every side that would have
+				float num_pushes = 0.f;
+				if (is_being_pushing(entity, entity_other)) { num_pushes += 1.f; }
+				if (motion_other.moving && motion_other.cell_index != INT_MAX && is_being_pushing(entity_other, entity)) {
+					num_pushes += 1.f;
+				}
+				if (num_pushes > 0.f && lanes.is_pushing[i]) { // Same as motions_push(), which is antisymmetric
+					motion.velocity += lanes.push_velocities[i] * (motion_other.mass * num_pushes);
+					motion_other.velocity -= lanes.push_velocities[i] * (motion.mass * num_pushes);
+					wake_motion(entity_other); // Grid neighbours of an awake motion may be asleep
+				}
 			}
+			Entity entity1 = (motion_other.type_mask > motion.type_mask) ? entity : entity_other;
+			Entity entity2 = (motion_other.type_mask > motion.type_mask) ? entity_other : entity;
+			registry.collisions.emplace_with_duplicates(entity1, entity2, combined_type_mask); // An entity can collide with several others
+		}
+	}
+
+	// Last do dynamic-static collisions, grouped by the moving entity since platforms cancel the pushes of other polygons
+	std::sort(static_pairs.begin(), static_pairs.end(), [](const StaticPair& p1, const StaticPair& p2) {
+		unsigned int id1 = Entity(p1.entity), id2 = Entity(p2.entity);
+		return id1 < id2 || (id1 == id2 && (unsigned int)Entity(p1.entity_other) < (unsigned int)Entity(p2.entity_other));
+	});
+	static_pair_groups.clear();
+	for (uint i = 0; i < static_pairs.size(); i++) {
+		if (i == 0 || static_pairs[i].entity != static_pairs[i - 1].entity) {
+			static_pair_groups.push_back(i);
 		}
 	}
-	RenderRequest& render_request = registry.renderRequests.get(entity);
-	render_request.transparency = clamp(render_request.transparency + transparency_change, 0.f, 0.7f);
+	uint num_groups = (uint)static_pair_groups.size();
+	static_pair_groups.push_back((uint)static_pairs.size());
+
+	// A group only writes the velocity of its own moving entity, and only reads positions of the others
+	const StaticColliders& statics = spatial_grid.static_colliders;
+	job_system.parallel_for(num_groups, MOTION_CHUNK_SIZE / 4, [&](uint begin, uint end) {
+		for (uint group = begin; group < end; group++) {
+			Motion& motion = registry.motions.get(static_pairs[static_pair_groups[group]].entity);
+			vec2 polygon_push_velocity = {0.f, 0.f};
+			bool is_testing_platforms = false;
+			for (uint i = static_pair_groups[group]; i < static_pair_groups[group + 1]; i++) {
+				const StaticPair& pair = static_pairs[i];
+				bool is_baked = pair.baked_index >= 0;
+				if (pair.type_mask == POLYGON_MASK) {
+					ComplexPolygon* polygon = (is_baked) ? nullptr : &registry.polygons.get(pair.entity_other);
+					bool is_platform = (is_baked) ? statics.polygon_is_platform[pair.baked_index] : polygon->is_platform;
+					auto polygon_push = [&]() {
+						return (is_baked) ? statics.circle_polygon_push(pair.baked_index, motion.position, motion.radius, motion.velocity)
+							: is_circle_polygon_edge_colliding(*polygon, motion);
+					};
+					if (is_testing_platforms) {
+						if (is_platform) {
+							motion.velocity += polygon_push();
+						}
+					} else {
+						vec2 push_velocity = polygon_push();
+
+						if (is_platform) {
+							if ((is_baked) ? statics.is_point_within_polygon(pair.baked_index, motion.position) : is_point_within_polygon(*polygon, motion.position)) {
+								is_testing_platforms = true;
+								motion.velocity -= polygon_push_velocity;
+							}
+						}
+						polygon_push_velocity += push_velocity;
+						motion.velocity += push_velocity;
+					}
+				} else if (is_baked) {
+					obstacle_push(motion, statics.circle_positions[pair.baked_index], statics.circle_radii[pair.baked_index]);
+				} else {
+					const Motion& motion_other = registry.motions.get(pair.entity_other);
+					vec2 push_velocity;
+					if (motion_other.type_mask == OBSTACLE_MASK) { // Same as motions_push() but without touching motion_other
+						obstacle_push(motion, motion_other.position, motion_other.radius);
+					} else if (get_push_velocity(motion, motion_other, push_velocity)) {
+						motion.velocity += push_velocity * motion_other.mass;
+					}
+				}
+			}
+		}
+	});
 }
 
 
 
 
 
+
 // Debugging:
 WorldDebugInfo world_debug_info; // Holds world debug info like play bounds and dir_light location
 DIFFUSE_ID CIRCLE_ID = DIFFUSE_ID::CIRCLE; // For better readability
@@ -403,6 +717,14 @@ void remove_collider_debug(Entity entity)
 	}
 }
 
+// Debug shapes are never awake, so nothing integrates them: keep last_position with the position so they're drawn right there
+void place_debug_motion(Entity entity, vec2 position)
+{
+	Motion& motion = registry.motions.get(entity);
+	motion.last_position = position;
+	motion.position = position;
+}
+
 std::vector<Entity> raster_line_debug = {};
 int frame_num = 0;
 void PhysicsSystem::update_debug()
@@ -423,15 +745,15 @@ void PhysicsSystem::update_debug()
 			registry.motions.get(ray).angle = atan2(ray_vector.y, ray_vector.x);
 			raster_line_debug.push_back(ray);
 
-			std::vector<Cell> cells = spatial_grid.raster_line(player_motion.position, other_pos);
+			std::vector<Cell*> cells = spatial_grid.raster_line(player_motion.position, other_pos);
 			Entity entity1 = createColliderDebug(other_pos, { 10.f, 10.f }, LINE_ID, vec3(0.f, 1.f, 0.f));
 			
 			raster_line_debug.push_back(entity1);
 			for (uint i = 0; i < cells.size(); i++) {
 				for (uint j = 0; j < cells.size(); j++) {
-					if (j != i) { assert(cells[i].coords != cells[j].coords); }
+					if (j != i) { assert(cells[i] != cells[j]); }
 				}
-				Cell& cell = cells[i];
+				Cell& cell = *cells[i];
 				//printf("cell.coords  =  %d : %d\n", cell.coords.x, cell.coords.y);
 				vec3 color = (i == 0) ? vec3(1.f, 0.f, 1.f) : vec3(0.f, 0.f, 1.f);
 				Entity entity = createColliderDebug(((vec2)cell.coords + vec2(0.5f)) * WorldSystem::TILE_SIZE, vec2(WorldSystem::TILE_SIZE - 2.f), LINE_ID, color, 0.8f);
@@ -452,8 +774,7 @@ void PhysicsSystem::update_debug()
 		////
 
 		auto& motion_registry = registry.motions;
-		uint size_before_adding_new = (uint)motion_registry.components.size();
-		for (uint i = 0; i < size_before_adding_new; i++)
+		for (uint i = 0; i < motion_registry.components.size(); i++)
 		{
 			Motion& motion_i = motion_registry.components[i];
 			Entity entity_i = motion_registry.entities[i];
@@ -462,24 +783,27 @@ void PhysicsSystem::update_debug()
 				if (!motion_i.moving) continue;
 				ColliderDebug& collider_debug = registry.colliderDebugs.get(entity_i);
 				if (motion_registry.has(collider_debug.circle)) {
-					motion_registry.get(collider_debug.circle).position = motion_i.position;
+					place_debug_motion(collider_debug.circle, motion_i.position);
 					if (motion_i.type_mask & DOOR_MASK) printf("YUP\n");
 				}
 				BBox bbox = get_bbox(motion_i);
 				if (!(motion_i.type_mask & DOOR_MASK) && motion_registry.has(collider_debug.box)) {
-					motion_registry.get(collider_debug.box).position = motion_i.position;
+					place_debug_motion(collider_debug.box, motion_i.position);
 					motion_registry.get(collider_debug.box).sprite_offset = motion_i.sprite_offset;
 				}
 				if ((motion_i.type_mask & BEING_MASK) && motion_registry.has(collider_debug.look_line)) {
-					motion_registry.get(collider_debug.look_line).position = motion_i.position + (40.f * motion_i.look_direction);
+					place_debug_motion(collider_debug.look_line, motion_i.position + (40.f * motion_i.look_direction));
 					motion_registry.get(collider_debug.look_line).angle =
 						atan2(motion_i.look_direction.y, motion_i.look_direction.x) + M_PI;
 				}
 				if (motion_registry.has(collider_debug.cell)) {
-					motion_registry.get(collider_debug.cell).position = ((vec2)motion_i.cell_coords + vec2(0.5f)) * WorldSystem::TILE_SIZE;
+					place_debug_motion(collider_debug.cell, ((vec2)motion_i.cell_coords + vec2(0.5f)) * WorldSystem::TILE_SIZE);
 				}
-			} else {
-				create_motion_collider_debug(i);
+			} else { // Create after the loop since it adds motions
+				registry.commands.defer([entity_i]() {
+					if (registry.motions.has(entity_i) && !registry.colliderDebugs.has(entity_i))
+						create_motion_collider_debug(registry.motions.get_index(entity_i));
+				});
 			}
 		}
 		
@@ -492,21 +816,20 @@ void PhysicsSystem::update_debug()
 		vec2 dir_light_spot_offset = p * vec2(dir_light.direction.x, dir_light.direction.y);
 		Motion& dir_light_spot_motion = registry.motions.get(world_debug_info.sun_spot);
 		vec2 center_offset = vec2(0.f, 100.f); // Moves the sun debug info downwards on the screen a bit
-		dir_light_spot_motion.position = camera_position + dir_light_spot_offset + center_offset;
+		place_debug_motion(world_debug_info.sun_spot, camera_position + dir_light_spot_offset + center_offset);
 		dir_light_spot_motion.scale = dir_light_spot_size_scaled;
-		registry.motions.get(world_debug_info.center_of_sun_spot).position = dir_light_spot_motion.position;
-		registry.motions.get(world_debug_info.sun_across_line).position = camera_position + center_offset;
+		place_debug_motion(world_debug_info.center_of_sun_spot, dir_light_spot_motion.position);
+		place_debug_motion(world_debug_info.sun_across_line, camera_position + center_offset);
 		registry.motions.get(world_debug_info.sun_across_line).angle = world_lighting.theta;
-		registry.motions.get(world_debug_info.center_of_screen).position = camera_position + center_offset;
+		place_debug_motion(world_debug_info.center_of_screen, camera_position + center_offset);
 		Motion& frustum_motion = registry.motions.get(world_debug_info.view_frustum);
-		frustum_motion.position = camera_position;
+		place_debug_motion(world_debug_info.view_frustum, camera_position);
 		frustum_motion.scale = camera.frustum_size / camera.scale_factor;
 	}
 }
 
 void create_polygon_debug(int motion_index, ComplexPolygon& polygon, vec3 color)
 {
-	Motion motion = registry.motions.components[motion_index];
 	Entity entity = registry.motions.entities[motion_index];
 	for (uint i = 0; i < polygon.world_edges.size(); i++) {
 		Edge edge = polygon.world_edges[i];
@@ -545,9 +868,9 @@ void toggle_debug()
 			ComplexPolygon& polygon = registry.polygons.components[i];
 			vec3 color = (polygon.is_platform) ? vec3(1.f, 0.f, 1.f) : vec3(0.f, 1.f, 0.f);
 
-			std::vector<Cell> cells = spatial_grid.raster_polygon(polygon, 100.f, i == 0);
+			std::vector<Cell*> cells = spatial_grid.raster_polygon(polygon, 100.f, i == 0);
 			for (uint i = 0; i < cells.size(); i++) {
-				vec2 cell_position = ((vec2)cells[i].coords + vec2(0.5f)) * WorldSystem::TILE_SIZE;
+				vec2 cell_position = ((vec2)cells[i]->coords + vec2(0.5f)) * WorldSystem::TILE_SIZE;
 				createColliderDebug(cell_position, vec2(WorldSystem::TILE_SIZE - 2.f), LINE_ID, color, 0.4f);
 			}
 		}
@@ -7,6 +7,10 @@
 #include "spatial_grid.hpp"
 
 void remove_collider_debug(Entity entity);
+// First pass of PhysicsSystem::step(), moves every awake motion by its velocity
+void integrate_motions(float step_seconds, vec2 room_size, float clamp_inset);
+// Puts a sleeping motion back into the physics step. Call after giving something that may be asleep a velocity or force
+void wake_motion(Entity entity);
 
 struct WorldDebugInfo {
 	Entity room_edge_top;
@@ -27,13 +31,61 @@ public:
 	void step(float elapsed_ms);
 
 	void update_motion_cells(Entity entity, Motion& motion);
+	void update_sleep(Entity entity, Motion& motion, Awake& awake, float elapsed_ms);
 
-	void moving_check_collisions(Entity entity, Motion& motion);
-	void obstacle_transparency(Entity entity, Motion& motion);
+	void find_collision_pairs();
+	void resolve_collision_pairs();
 
 	void update_debug();
 
+	double collision_elapsed_ms = 0; // Time spent in find/resolve_collision_pairs() since last reset, see main.cpp
+
 	PhysicsSystem() {}
+
+private:
+	struct CollisionPair {
+		uint64_t key; // Lower entity id in the high bits, used to sort and find duplicates
+		Entity entity; // The moving motion that found the pair
+		Entity entity_other;
+	};
+	// Reused every frame so the broadphase doesn't allocate once warmed up
+	std::vector<CollisionPair> collision_pairs;
+	struct StaticPair {
+		Entity entity; // The moving being
+		Entity entity_other;
+		uint32 type_mask; // OBSTACLE_MASK or POLYGON_MASK
+		int baked_index; // Circle/polygon index in SpatialGrid::static_colliders, -1 if entity_other is in the live grid
+	};
+	std::vector<StaticPair> static_pairs;
+	struct CircleLanes { // SoA copy of the circles of collision_pairs for are_circles_colliding()
+		std::vector<float> x1, y1, x2, y2, combined_radii;
+		std::vector<uint8_t> is_colliding;
+		std::vector<vec2> push_velocities; // Being-being push, precomputed so the serial pass only has to add it
+		std::vector<uint8_t> is_pushing;
+		void resize(uint size) {
+			x1.resize(size); y1.resize(size); x2.resize(size); y2.resize(size); combined_radii.resize(size);
+			is_colliding.resize(size); push_velocities.resize(size); is_pushing.resize(size);
+		}
+	};
+	CircleLanes circle_lanes;
+	struct DirectCollision { // A collision the broadphase settled itself (baked obstacles, swept projectiles), registered once it's merged
+		Entity entity1;
+		Entity entity2;
+		uint32 combined_type_mask;
+	};
+	struct SweptHit { // A new contact of a swept projectile, time being its fraction of the step
+		float time;
+		Entity entity_other;
+	};
+	struct BroadphaseChunk { // Output of one chunk of motions, chunks are merged in order so any thread count gives the same result
+		std::vector<CollisionPair> collision_pairs;
+		std::vector<StaticPair> static_pairs;
+		std::vector<DirectCollision> direct_collisions;
+		std::vector<SweptHit> swept_hits; // Scratch for sweep_projectile()
+	};
+	std::vector<BroadphaseChunk> broadphase_chunks;
+	void sweep_projectile(Entity entity, const Motion& motion, BroadphaseChunk& chunk);
+	std::vector<uint> static_pair_groups; // Start of each moving entity's run in the sorted static_pairs, plus the end
 };
 
 void toggle_debug();
@@ -15,7 +15,7 @@ void RenderSystem::set_dir_light_and_view(const GLuint program) // Constant for
 	DirLight& dir_light = registry.dirLights.get(world_lighting.dir_light);
 	Camera& camera = registry.cameras.components[0];
 
-	vec3 camera_3D_position = vec3(camera.position, 0.0) + camera.direction * 1000.f;
+	vec3 camera_3D_position = vec3(get_render_position(camera), 0.0) + camera.direction * 1000.f;
 	glUniform3fv(glGetUniformLocation(program, "view_position"), 1, (float*)&camera_3D_position);
 	glUniform3fv(glGetUniformLocation(program, "dir_light.direction"), 1, (float*)&dir_light.direction); // Don't normalize
 	glUniform3fv(glGetUniformLocation(program, "dir_light.ambient"), 1, (float*)&dir_light.ambient);
@@ -38,7 +38,7 @@ void RenderSystem::set_point_lights(const GLuint program) // Constant for all te
 		PointLight& point_light = registry.pointLights.components[i];
 		Motion& motion = registry.motions.get(registry.pointLights.entities[i]);
 		vec3 offset_3D = vec3(0.0, motion.sprite_offset.y * motion.sprite_normal.z, -motion.sprite_offset.y * motion.sprite_normal.y);
-		point_light.position = vec3(motion.position, 0.f) + offset_3D + point_light.offset_position;
+		point_light.position = vec3(get_render_position(motion), 0.f) + offset_3D + point_light.offset_position;
 	}
 
 	// Update light_ssbo (which has already been bound to location 1)
@@ -81,12 +81,13 @@ mat3 RenderSystem::calc_shadow_transform(const Motion& motion, vec3 sprite_norma
 {
 	//Camera& camera = registry.cameras.components[0];
 	Transform transform;
-	transform.translate(motion.position); // Finally, move it to it's position in the world
+	vec2 render_position = get_render_position(motion);
+	transform.translate(render_position); // Finally, move it to it's position in the world
 	// Note: The scale below does nothing to entities with normal pointing straight up, the dot() is == 1 (so shadows don't need this)
 	//transform.scale(vec2(1.f, dot(camera.direction, sprite_normal) / camera.scale_factor.y)); // Resize entity based on camera tilt
 	//WorldLighting& world_lighting = registry.worldLightings.components[0];
 		
-	vec3 light_to_pos = light_position - vec3(motion.position, 0.f);
+	vec3 light_to_pos = light_position - vec3(render_position, 0.f);
 	float horizontal_distance = length(vec3(light_to_pos.x, light_to_pos.y, 0.f));
 	float half_scale_x = motion.scale.x / 2.f;
 	float tan_shadow_angle = half_scale_x / horizontal_distance;
@@ -134,7 +135,7 @@ mat4 RenderSystem::calc_model_matrix(const Motion& motion, vec3 sprite_normal, c
 	mat4 model_matrix;
 	if (sprite_normal.z < 0.95f) {
 		vec3 offset_3D = vec3(0.0, motion.sprite_offset.y * sprite_normal.z, -motion.sprite_offset.y * sprite_normal.y);
-		vec3 world_3D_position = vec3(motion.position, 0.f) + offset_3D;
+		vec3 world_3D_position = vec3(get_render_position(motion), 0.f) + offset_3D;
 		mat3 TBN_scaled = TBN * mat3({ motion.scale.x,0,0 }, { 0,motion.scale.y,0 }, { 0,0,1 });
 		return mat4(vec4(TBN_scaled[0], 0.f), vec4(-TBN_scaled[1], 0.f), vec4(TBN_scaled[2], 0.f), vec4(world_3D_position, 1.f));
 	}
@@ -209,9 +210,6 @@ InstanceData& RenderSystem::addToBatch(Entity entity, RenderRequest& render_requ
 	//int num_lights_affecting = render_request.num_lights_affecting;
 	//render_request.num_lights_affecting = 0; // Must reset this before culling
 
-	// Frustum culling to avoid calculating matrices for entities outside of view space:
-	if (!is_shadow && motion.is_culled && !render_request.is_ground_piece) return instance_data[-1]; // don't add entities outside of the frustum to the batch
-
 	// Try adding textures but if ends up past 32, then need to flush below. Flush will not draw this entity, so must get_texture again below
 	int texture_indices[4];
 	get_texture_indices(texture_indices, render_request, is_shadow);
@@ -224,7 +222,7 @@ InstanceData& RenderSystem::addToBatch(Entity entity, RenderRequest& render_requ
 	num_instances++; // Must remain below the above check otherwise will be writing to instance_data[-1]
 	InstanceData& instance = instance_data[num_instances - 1];
 
-	instance.entity_id = (float)entity;
+	instance.entity_id = (float)entity.index(); // Must match PointLight::entity_id
 
 	//Transform transform; //transform.rotate(motion.angle); //transform.scale(motion.scale); //instance.shadow_transform = transform.mat;
 
@@ -247,7 +245,7 @@ InstanceData& RenderSystem::addToBatch(Entity entity, RenderRequest& render_requ
 		}
 		instance.TBN = render_request.TBN;
 
-		instance.position = motion.position;
+		instance.position = get_render_position(motion);
 		instance.scale = motion.scale;
 		instance.sprite_offset = motion.sprite_offset;
 		instance.sprite_normal = motion.sprite_normal;
@@ -290,51 +288,56 @@ void RenderSystem::drawTexturedSprites(bool is_shadow, int MAX_INSTANCES_VBO_IBO
 	vec3 dir_light_3D_position = vec3(0.0) + dir_light.direction * 100000000.f;
 	bool is_dir_light_shadows = dir_light.direction.z > 0.2f;
 	// num_instances = 0; num_textures = 0; map_texture_index.clear();
-	for (size_t i = 0; i < registry.renderRequests.entities.size(); i++)
+	if (!is_shadow) { // Frustum culling, only what the CullingSystem found in view. Also in renderRequests' sorted order
+		for (Entity entity : registry.cameras.components[0].visible_entities) {
+			RenderRequest* render_request = registry.renderRequests.find(entity);
+			Motion* motion = registry.motions.find(entity);
+			if (!render_request || !motion) { continue; } // Removed since the last physics step
+			if (render_request->effect_id != EFFECT_ID::TEXTURED || render_request->is_ground_piece) { continue; }
+			addToBatch(entity, *render_request, *motion, is_shadow, MAX_INSTANCES_VBO_IBO);
+		}
+		if (num_instances > 0) { drawBatchFlush(MAX_INSTANCES_VBO_IBO); }
+		gl_has_errors();
+		return;
+	}
+	for (auto [entity, render_request, motion] : registry.view<RenderRequest, Motion>()) // Keeps renderRequests' sorted order
 	{
-		Entity entity = registry.renderRequests.entities[i];
-		RenderRequest& render_request = registry.renderRequests.components[i];
-		if (!is_shadow) { render_request.num_lights_affecting = 0; }
+		// Shadows can reach into view from anywhere, so these go through everything
+		int num_lights_affecting = render_request.num_lights_affecting;
+		render_request.num_lights_affecting = 0; // The LightingSystem fills it again next frame
 
-		Motion& motion = registry.motions.get(entity);
-		if (is_shadow && render_request.geometry_id == GEOMETRY_ID::PLANE && is_dir_light_shadows) { // PLANEs will be ignored below
+		if (render_request.geometry_id == GEOMETRY_ID::PLANE && is_dir_light_shadows) { // PLANEs will be ignored below
 			InstanceData& instance = addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
 			float shadow_scale = 0.f;
 			instance.transform = calc_shadow_transform(motion, vec3(0, 0, 1), dir_light_3D_position, shadow_scale);
 			instance.shadow_scale = shadow_scale;
 		}
-		if (render_request.effect_id != EFFECT_ID::TEXTURED || render_request.is_ground_piece
-			|| (is_shadow && !render_request.casts_shadow)) { continue; }
-
-		if (!is_shadow) {
-			addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
-		} else if (is_shadow) {
-			if (is_dir_light_shadows) {
-				InstanceData& instance = addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
-				float shadow_scale = 0.f;
-				instance.transform = calc_shadow_transform(motion, vec3(0, 0, 1), dir_light_3D_position, shadow_scale);
-				instance.shadow_scale = shadow_scale;
-			}
+		if (render_request.effect_id != EFFECT_ID::TEXTURED || render_request.is_ground_piece || !render_request.casts_shadow) { continue; }
 
-			int num_lights = registry.pointLights.components.size();
-			//printf("Render shadows num_lights: %d\n", num_lights);
-			for (int i = 0; i < render_request.num_lights_affecting; i++) {
-				//printf("hello\n);
-				int point_light_index = render_request.lights_affecting[i];
-				if (point_light_index >= num_lights) { 
-					assert(false);
-				}
-				PointLight& point_light = registry.pointLights.components[point_light_index];
-				if (point_light.entity_id == entity) continue;
-
-				InstanceData& instance = addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
-				float shadow_scale = 0.f;
-				instance.transform = calc_shadow_transform(motion, vec3(0, 0, 1), vec3(point_light.position.x, point_light.position.y, 15), shadow_scale);
-				instance.num_lights_affecting = point_light_index;
-				instance.shadow_scale = shadow_scale;
+		if (is_dir_light_shadows) {
+			InstanceData& instance = addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
+			float shadow_scale = 0.f;
+			instance.transform = calc_shadow_transform(motion, vec3(0, 0, 1), dir_light_3D_position, shadow_scale);
+			instance.shadow_scale = shadow_scale;
+		}
+
+		int num_lights = registry.pointLights.components.size();
+		//printf("Render shadows num_lights: %d\n", num_lights);
+		for (int i = 0; i < num_lights_affecting; i++) {
+			//printf("hello\n);
+			int point_light_index = render_request.lights_affecting[i];
+			if (point_light_index >= num_lights) { 
+				assert(false);
 			}
+			PointLight& point_light = registry.pointLights.components[point_light_index];
+			if (point_light.entity_id == (float)entity.index()) continue;
+
+			InstanceData& instance = addToBatch(entity, render_request, motion, is_shadow, MAX_INSTANCES_VBO_IBO);
+			float shadow_scale = 0.f;
+			instance.transform = calc_shadow_transform(motion, vec3(0, 0, 1), vec3(point_light.position.x, point_light.position.y, 15), shadow_scale);
+			instance.num_lights_affecting = point_light_index;
+			instance.shadow_scale = shadow_scale;
 		}
-		//render_request.num_lights_affecting = 0;
 	}
 	if (num_instances > 0) { drawBatchFlush(MAX_INSTANCES_VBO_IBO); } // Necessary to draw possible final batch of instances
 	gl_has_errors();
@@ -395,11 +398,8 @@ void RenderSystem::drawDebugComponents()
 	glUniform1f(glGetUniformLocation(program, "is_ground_piece"), true);
 	glDisable(GL_DEPTH_TEST); glEnable(GL_BLEND);
 	num_instances = 0; num_textures = 0; map_texture_index.clear();
-	for (size_t i = 0; i < registry.debugComponents.entities.size(); i++)
+	for (auto [entity, debug_component, render_request, motion] : registry.view<DebugComponent, RenderRequest, Motion>())
 	{
-		Entity entity = registry.debugComponents.entities[i];
-		RenderRequest& render_request = registry.renderRequests.get(entity);
-		Motion& motion = registry.motions.get(entity);
 		assert(render_request.effect_id == EFFECT_ID::TEXTURED);
 
 		addToBatch(entity, render_request, motion, false, MAX_SPRITE_INSTANCES);
@@ -733,8 +733,10 @@ void RenderSystem::drawToScreen() // Unused
 
 // Render our game world
 // http://www.opengl-tutorial.org/intermediate-tutorials/tutorial-14-render-to-texture/
-void RenderSystem::draw(GameState game_state)
+void RenderSystem::draw(GameState game_state, float interpolation_alpha)
 {
+	this->interpolation_alpha = interpolation_alpha;
+
 	// Getting size of window
 	int w, h;
 	glfwGetFramebufferSize(window, &w, &h); // Note, this will be 2x the resolution given to glfwCreateWindow on retina displays
@@ -755,16 +757,19 @@ void RenderSystem::draw(GameState game_state)
 	if (game_state == GameState::IN_GAME || game_state == GameState::GAME_FROZEN) {
 		frame_num2++;
 		Room& room = registry.rooms.components[0];
-		// Sort on room initilization and every now and then to keep batching clean
-		if (!room.is_render_updated || frame_num2 % 10000 == 0) {
+		// Sort on room initilization to keep batching clean
+		if (!room.is_render_updated) {
 			room.is_render_updated = true;
 			auto sort_start = Clock::now();
-			registry.renderRequests.sort([](Entity e1, Entity e2) {
-				return (int)registry.renderRequests.get(e1).diffuse_id < (int)registry.renderRequests.get(e2).diffuse_id;
+			// In place sort, after which new render requests are inserted in diffuse_id order
+			registry.renderRequests.keep_sorted_by([](const RenderRequest& render_request) {
+				return (int)render_request.diffuse_id;
 			});
 			sort_elapsed += (double)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sort_start)).count() / 1000;
 			printf("Sort Elapsed:	%fms\n", sort_elapsed); sort_elapsed = 0;
 		}
+		// Render requests whose diffuse_id was changed after insertion (e.g. switching characters)
+		registry.renderRequests.restore_sorted_order();
 
 		GLuint textured_program = (GLuint)effects[(GLuint)EFFECT_ID::TEXTURED];
 
@@ -875,7 +880,8 @@ mat3 RenderSystem::createProjectionMatrix()
 
 	float sx = camera.zoom / (right - left);
 	float sy = camera.scale_factor.y * (camera.zoom / (top - bottom)); // Scale the world based on camera tilt
-	float tx = -(camera.zoom * camera.position.x) / (right - left);
-	float ty = camera.scale_factor.y * ((camera.zoom * camera.position.y) / bottom);
+	vec2 camera_position = get_render_position(camera);
+	float tx = -(camera.zoom * camera_position.x) / (right - left);
+	float ty = camera.scale_factor.y * ((camera.zoom * camera_position.y) / bottom);
 	return { {sx, 0.f, 0.f}, {0.f, sy, 0.f}, {tx, ty, 1.f} };
 }
\ No newline at end of file
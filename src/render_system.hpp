@@ -335,11 +335,15 @@ public:
 	// Destroy resources associated to one or all entities created by the system
 	~RenderSystem();
 
-	// Draw all entities
-	void draw(GameState game_state);
+	// Draw all entities. interpolation_alpha is how far this frame is from the second last to the last simulation step
+	void draw(GameState game_state, float interpolation_alpha = 1.f);
 
 	mat3 createProjectionMatrix();
 
+	// Where things are drawn this frame, in between their positions of the last two simulation steps (see main.cpp)
+	vec2 get_render_position(const Motion& motion) const { return mix(motion.last_position, motion.position, interpolation_alpha); }
+	vec2 get_render_position(const Camera& camera) const { return mix(camera.last_position, camera.position, interpolation_alpha); }
+
 private:
 	void set_vbo_and_ibo(const GLuint program, GEOMETRY_ID geometry_id, int MAX_INSTANCES_VBO_IBO = INT_MAX);
 	void set_dir_light_and_view(const GLuint program);
@@ -376,6 +380,7 @@ private:
 	int num_textures;
 
 	vec3 camera_direction = { 0,0,1 }; // Unfinished optimization, only calculate certain transformations if camera is changing
+	float interpolation_alpha = 1.f; // See draw()
 
 	// Window handle
 	GLFWwindow* window;
@@ -1,46 +1,117 @@
 // internal
 #include "spatial_grid.hpp"
+#include "world_init.hpp" // For the type masks
+
+#include <chrono>
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SPATIAL_GRID_AVX
+#define SPATIAL_GRID_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SPATIAL_GRID_SSE2
+#endif
+
+using Clock = std::chrono::high_resolution_clock;
+
+
+void PolygonEdges::clear()
+{
+	start_x.clear(); start_y.clear(); end_x.clear(); end_y.clear();
+	unit_x.clear(); unit_y.clear(); normal_x.clear(); normal_y.clear();
+	lengths.clear(); is_collidable.clear();
+}
+
+void PolygonEdges::push_back(const Edge& edge)
+{
+	vec2 line_vector = edge.vertex2 - edge.vertex1;
+	vec2 line_vector_unit = normalize(line_vector);
+	vec2 line_normal = normalize(vec2(line_vector.y, -line_vector.x));
+	start_x.push_back(edge.vertex1.x); start_y.push_back(edge.vertex1.y);
+	end_x.push_back(edge.vertex2.x); end_y.push_back(edge.vertex2.y);
+	unit_x.push_back(line_vector_unit.x); unit_y.push_back(line_vector_unit.y);
+	normal_x.push_back(line_normal.x); normal_y.push_back(line_normal.y);
+	lengths.push_back(length(line_vector));
+	is_collidable.push_back(edge.is_collidable);
+}
+
+void PolygonEdges::append(const PolygonEdges& other)
+{
+	auto append_vector = [](auto& to, const auto& from) { to.insert(to.end(), from.begin(), from.end()); };
+	append_vector(start_x, other.start_x); append_vector(start_y, other.start_y);
+	append_vector(end_x, other.end_x); append_vector(end_y, other.end_y);
+	append_vector(unit_x, other.unit_x); append_vector(unit_y, other.unit_y);
+	append_vector(normal_x, other.normal_x); append_vector(normal_y, other.normal_y);
+	append_vector(lengths, other.lengths); append_vector(is_collidable, other.is_collidable);
+}
+
+void ComplexPolygon::update_edges()
+{
+	edges.clear();
+	vec2 max_position = { -100000, -100000 };
+	vec2 min_position = { 100000, 100000 };
+	for (const Edge& edge : world_edges) {
+		edges.push_back(edge);
+		max_position = glm::max(max_position, glm::max(edge.vertex1, edge.vertex2));
+		min_position = glm::min(min_position, glm::min(edge.vertex1, edge.vertex2));
+	}
+	bbox = { min_position.x, max_position.x, min_position.y, max_position.y };
+}
 
 
 void Cell::remove_entity(int entity_index) {
-	assert(entity_index >= 0 && entity_index < MAX_ENTITIES_PER_CELL && this->num_entities - 1 >= 0);
-	//printf("Entity given: %d. At index: %d.    entity removed: %d.   entity at end: %d\n", e, entity_index, this->entities[entity_index], this->entities[this->num_entities - 1]);
-	//printf("Num_entities before removing: %d. Array before removing:\n", this->num_entities);
+	assert(entity_index >= 0 && entity_index < (int)this->entities.size());
+	//printf("Entity given: %d. At index: %d.    entity removed: %d.   entity at end: %d\n", e, entity_index, this->entities[entity_index], this->entities.back());
 
-	Entity entity_at_end = this->entities[this->num_entities - 1];
+	Entity entity_at_end = this->entities.back();
 	this->entities[entity_index] = entity_at_end;
 	Motion& motion = registry.motions.get(entity_at_end); // Kinda hacky
 	motion.cell_index = entity_index;
 
-	this->num_entities--;
-	//printf("Num_entities after removing: %d\n", this->num_entities);
+	this->entities.pop_back();
 }
 int Cell::add_entity(Entity entity) { // returns index of newly placed entity
-	assert(this->num_entities >= 0 && this->num_entities < MAX_ENTITIES_PER_CELL && "Error or need to add more space to entity list");
-	this->entities[this->num_entities] = entity;
-	this->num_entities++;
-	//printf("Num_entities after adding = %d\n", this->num_entities);
-	return this->num_entities - 1;
+	this->entities.push_back(entity);
+	//printf("Num_entities after adding = %d\n", this->num_entities());
+	return (int)this->entities.size() - 1;
 }
 
 int SpatialGrid::add_entity_to_cell(ivec2 cell_coords, Entity entity) {
-	int index = this->grid[cell_coords.x][cell_coords.y].add_entity(entity);
+	Cell& cell = get_cell(cell_coords);
+	int index = cell.add_entity(entity);
+	cell.num_sleeping += registry.motions.get(entity).is_sleeping;
 	//printf("Adding entity [%d] to cell: [%d | %d] gives index: [%d]\n", (int)entity, cell_coords.x, cell_coords.y, index);
 	return index;
 }
 void SpatialGrid::remove_entity_from_cell(ivec2 cell_coords, int entity_index, Entity e) {
-	this->grid[cell_coords.x][cell_coords.y].remove_entity(entity_index);
+	Cell& cell = get_cell(cell_coords);
+	cell.num_sleeping -= registry.motions.get(e).is_sleeping;
+	cell.remove_entity(entity_index);
+}
+
+void SpatialGrid::resize(ivec2 new_grid_size) {
+	clear_all_cells();
+	if (new_grid_size == this->grid_size) { return; }
+	printf("Resizing Spatial Grid to %d x %d\n", new_grid_size.x, new_grid_size.y);
+	this->grid_size = new_grid_size;
+	this->grid.clear();
+	this->grid.reserve(new_grid_size.x * new_grid_size.y);
+	for (int X = 0; X < new_grid_size.x; X++) {
+		for (int Y = 0; Y < new_grid_size.y; Y++) {
+			this->grid.push_back(Cell({ X, Y }));
+		}
+	}
+	this->coarse_grid_size = (new_grid_size + COARSE_CELL_FACTOR - 1) / COARSE_CELL_FACTOR;
+	this->coarse_grid.clear();
+	this->coarse_grid.resize(coarse_grid_size.x * coarse_grid_size.y);
 }
 
 void SpatialGrid::check_all_cells() {
 	printf("Checking all cells\n");
-	for (uint X = 0; X < NUM_CELLS; X++) {
-		for (uint Y = 0; Y < NUM_CELLS; Y++) {
-			Cell& cell = this->grid[X][Y];
-			for (int i = 0; i < cell.num_entities; i++) {
-				if (registry.motions.get(cell.entities[i]).type_mask == 128) {
-					printf("Ok\n");
-				}
+	for (Cell& cell : this->grid) {
+		for (int i = 0; i < cell.num_entities(); i++) {
+			if (registry.motions.get(cell.entities[i]).type_mask == 128) {
+				printf("Ok\n");
 			}
 		}
 	}
@@ -48,17 +119,163 @@ void SpatialGrid::check_all_cells() {
 
 void SpatialGrid::clear_all_cells() {
 	printf("Clearing all cells\n");
-	for (uint X = 0; X < NUM_CELLS; X++) {
-		for (uint Y = 0; Y < NUM_CELLS; Y++) {
-			this->grid[X][Y].num_entities = 0;
+	for (Cell& cell : this->grid) {
+		cell.entities.clear();
+		cell.num_sleeping = 0;
+	}
+	for (CoarseCell& cell : this->coarse_grid) {
+		cell.entities.clear();
+		cell.bboxes.clear();
+	}
+	this->static_colliders.clear();
+}
+
+void SpatialGrid::bake_static_colliders() {
+	auto bake_start = Clock::now();
+	StaticColliders& statics = this->static_colliders;
+	statics.clear();
+	auto bake_entity = [&](Entity entity) { // Returns false if the entity must stay in the live grid
+		Motion& motion = registry.motions.get(entity);
+		if (motion.cell_index == BAKED_ENTITY_INDEX) { return true; } // Already baked from another cell
+		if (motion.type_mask == OBSTACLE_MASK && !motion.moving) {
+			statics.add_circle(entity, motion.position, motion.radius);
+		} else if (motion.type_mask == POLYGON_MASK) {
+			statics.add_polygon(entity, registry.polygons.get(entity));
+		} else {
+			return false;
+		}
+		motion.cell_index = BAKED_ENTITY_INDEX;
+		return true;
+	};
+	for (Cell& cell : this->grid) { // Keep only what can move or be removed, fixing up their cell_index
+		uint num_kept = 0;
+		for (Entity entity : cell.entities) {
+			if (bake_entity(entity)) { continue; }
+			registry.motions.get(entity).cell_index = num_kept;
+			cell.entities[num_kept++] = entity;
+		}
+		cell.entities.resize(num_kept);
+	}
+	for (CoarseCell& cell : this->coarse_grid) {
+		for (Entity entity : cell.entities) {
+			bool is_baked = bake_entity(entity);
+			assert(is_baked); // Only static colliders go in the coarse level
+		}
+		cell.entities.clear();
+		cell.bboxes.clear();
+	}
+
+	std::vector<BBox> circle_bboxes(statics.num_circles());
+	for (uint i = 0; i < statics.num_circles(); i++) {
+		circle_bboxes[i] = statics.circle_bbox(i);
+	}
+	statics.circle_bins.build(this->grid_size, (float)cell_size, circle_bboxes);
+	statics.polygon_bins.build(this->coarse_grid_size, (float)(cell_size * COARSE_CELL_FACTOR), statics.polygon_bboxes);
+
+	float bake_elapsed = (float)(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - bake_start)).count() / 1000;
+	printf("Baked %d static circles and %d polygons (%d edges) in %fms\n",
+		statics.num_circles(), statics.num_polygons(), (int)statics.edges.size(), bake_elapsed);
+}
+
+void StaticBins::build(ivec2 new_size, float new_bin_size, const std::vector<BBox>& item_bboxes) {
+	this->size = new_size;
+	this->bin_size = new_bin_size;
+	first.assign(size.x * size.y + 1, 0);
+	// Count the items of each bin, turn the counts into offsets, then place the items
+	auto for_each_bin = [&](const BBox& bbox, auto func) {
+		ivec2 min_XY = get_bin_coords({ bbox.x_low, bbox.y_low });
+		ivec2 max_XY = get_bin_coords({ bbox.x_high, bbox.y_high });
+		for (int X = min_XY.x; X <= max_XY.x; X++) {
+			for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+				func(X * size.y + Y);
+			}
+		}
+	};
+	for (const BBox& bbox : item_bboxes) {
+		for_each_bin(bbox, [&](uint bin) { first[bin + 1]++; });
+	}
+	for (uint bin = 0; bin + 1 < first.size(); bin++) {
+		first[bin + 1] += first[bin];
+	}
+	items.resize(first.back());
+	std::vector<uint> next(first.begin(), first.end() - 1);
+	for (uint item = 0; item < item_bboxes.size(); item++) {
+		for_each_bin(item_bboxes[item], [&](uint bin) { items[next[bin]++] = item; });
+	}
+}
+
+void StaticColliders::clear() {
+	circle_entities.clear(); circle_positions.clear(); circle_radii.clear();
+	polygon_entities.clear(); polygon_bboxes.clear(); polygon_is_platform.clear();
+	polygon_first_edge.assign(1, 0);
+	edges.clear();
+	circle_bins = StaticBins();
+	polygon_bins = StaticBins();
+}
+
+void StaticColliders::add_circle(Entity entity, vec2 position, float radius) {
+	circle_entities.push_back(entity);
+	circle_positions.push_back(position);
+	circle_radii.push_back(radius);
+}
+
+void StaticColliders::add_polygon(Entity entity, const ComplexPolygon& polygon) {
+	polygon_entities.push_back(entity);
+	polygon_bboxes.push_back(polygon.bbox);
+	polygon_is_platform.push_back(polygon.is_platform);
+	edges.append(polygon.edges);
+	polygon_first_edge.push_back(edges.size());
+}
+
+void StaticColliders::remove(Entity entity) { // Rare, an inside out bbox never overlaps any query
+	for (uint i = 0; i < num_circles(); i++) {
+		if (circle_entities[i] == entity) { circle_radii[i] = -INFINITY; return; }
+	}
+	for (uint i = 0; i < num_polygons(); i++) {
+		if (polygon_entities[i] == entity) { polygon_bboxes[i] = { INFINITY, -INFINITY, INFINITY, -INFINITY }; return; }
+	}
+}
+
+vec2 StaticColliders::circle_polygon_push(uint polygon, vec2 circle_pos, float radius, vec2 velocity) const
+{
+	return circle_edges_push(edges, polygon_first_edge[polygon], polygon_first_edge[polygon + 1], circle_pos, radius, velocity);
+}
+
+bool StaticColliders::is_point_within_polygon(uint polygon, vec2 position) const
+{
+	const BBox& bbox = polygon_bboxes[polygon];
+	if (position.x < bbox.x_low || position.x > bbox.x_high || position.y < bbox.y_low || position.y > bbox.y_high) { return false; }
+	return is_point_within_edges(edges, polygon_first_edge[polygon], polygon_first_edge[polygon + 1], position);
+}
+
+void SpatialGrid::add_large_entity(Entity entity, BBox bbox) {
+	ivec2 min_XY = glm::max(get_coarse_cell_coords({ bbox.x_low, bbox.y_low }), ivec2(0));
+	ivec2 max_XY = glm::min(get_coarse_cell_coords({ bbox.x_high, bbox.y_high }), this->coarse_grid_size - 1);
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			CoarseCell& cell = this->coarse_grid[X * coarse_grid_size.y + Y];
+			cell.entities.push_back(entity);
+			cell.bboxes.push_back(bbox);
+		}
+	}
+}
+
+void SpatialGrid::remove_large_entity(Entity entity) { // Rare, so just check every coarse cell
+	for (CoarseCell& cell : this->coarse_grid) {
+		for (uint i = 0; i < cell.entities.size(); i++) {
+			if (cell.entities[i] != entity) { continue; }
+			cell.entities[i] = cell.entities.back();
+			cell.bboxes[i] = cell.bboxes.back();
+			cell.entities.pop_back();
+			cell.bboxes.pop_back();
+			break;
 		}
 	}
 }
 
 bool SpatialGrid::are_cell_coords_out_of_bounds(ivec2 cell_coords)
 {
-	Room& cur_room = registry.rooms.components[0];
-	return (cell_coords.x < 0 || cell_coords.y < 0 || cell_coords.x >= cur_room.grid_size.x || cell_coords.y >= cur_room.grid_size.y);
+	return (cell_coords.x < 0 || cell_coords.y < 0 || cell_coords.x >= this->grid_size.x || cell_coords.y >= this->grid_size.y);
 }
 
 ivec2 SpatialGrid::get_grid_cell_coords(vec2 position)
@@ -68,141 +285,67 @@ ivec2 SpatialGrid::get_grid_cell_coords(vec2 position)
 	return { cell_X, cell_Y };
 }
 
-// Unfinished
+ivec2 SpatialGrid::get_coarse_cell_coords(vec2 position)
+{
+	float coarse_cell_size = (float)(this->cell_size * COARSE_CELL_FACTOR);
+	return { (int)floor(position.x / coarse_cell_size), (int)floor(position.y / coarse_cell_size) };
+}
+
+void SpatialGrid::query_rect(ivec2 top_left_min_XY, ivec2 bottom_right_max_XY, std::vector<Entity>& entities_found)
+{
+	entities_found.clear();
+	for_each_in_rect(top_left_min_XY, bottom_right_max_XY, [&](Entity entity) { entities_found.push_back(entity); });
+}
+
+void SpatialGrid::query_radius(ivec2 center_cell, float radius, std::vector<Entity>& entities_found)
+{
+	entities_found.clear();
+	for_each_in_radius(center_cell, radius, [&](Entity entity) { entities_found.push_back(entity); });
+}
+
+void SpatialGrid::query_ray_cast(vec2 line_start, vec2 line_end, std::vector<Entity>& entities_found)
+{
+	entities_found.clear();
+	for_each_on_ray(line_start, line_end, [&](Entity entity) { entities_found.push_back(entity); });
+}
+
 std::vector<Entity> SpatialGrid::query_rect(ivec2 top_left_min_XY, ivec2 bottom_right_max_XY)
 {
 	std::vector<Entity> entities_found; entities_found.reserve(10);
-	for (int X = top_left_min_XY.x; X <= bottom_right_max_XY.x; X++) {
-		for (int Y = top_left_min_XY.y; Y <= bottom_right_max_XY.y; Y++) {
-			if (are_cell_coords_out_of_bounds({ X, Y })) continue;
-			Cell& cell = this->grid[X][Y];
-			for (int i = 0; i < cell.num_entities; i++) {
-				entities_found.push_back(cell.entities[i]);
-			}
-		}
-	}
+	query_rect(top_left_min_XY, bottom_right_max_XY, entities_found);
 	return entities_found;
 }
 
 std::vector<Entity> SpatialGrid::query_radius(ivec2 center_cell, float radius)
 {
 	std::vector<Entity> entities_found; entities_found.reserve(10);
-	float cell_radius = ceil(radius / this->cell_size);
-	ivec2 cell_radius_cells = ivec2(cell_radius);
-	ivec2 min_XY = center_cell - cell_radius_cells;
-	ivec2 max_XY = center_cell + cell_radius_cells;
-	for (int X = min_XY.x; X <= max_XY.x; X++) {
-		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
-			if (are_cell_coords_out_of_bounds({ X, Y })) continue;
-			Cell& cell = this->grid[X][Y];
-			for (int i = 0; i < cell.num_entities; i++) {
-				entities_found.push_back(cell.entities[i]);
-			}
-		}
-	}
+	query_radius(center_cell, radius, entities_found);
 	return entities_found;
 }
 
-std::vector<Entity> SpatialGrid::query_ray_cast(vec2 line_start, vec2 line_end) // TODO: Add radius here too
+std::vector<Entity> SpatialGrid::query_ray_cast(vec2 line_start, vec2 line_end)
 {
 	std::vector<Entity> entities_found; entities_found.reserve(10);
-	std::vector<Cell> cells = raster_line(line_start, line_end);
-	for (int i = 0; i < cells.size(); i++) {
-		Cell& cell = cells[i];
-		for (int j = 0; j < cell.num_entities; j++) {
-			entities_found.push_back(cell.entities[j]);
-		}
-	}
+	query_ray_cast(line_start, line_end, entities_found);
 	return entities_found;
 }
 
-// Unfinished - radius isn't working. Helper for the function below
-void SpatialGrid::add_radius_cells(ivec2 center, int radius, std::vector<Cell>& cells_list, bool used_cell_grid[NUM_CELLS][NUM_CELLS])
+std::vector<Cell*> SpatialGrid::raster_line(vec2 line_start, vec2 line_end)
 {
-	//for (int X = center.x - radius; X <= center.x + radius; X++) {
-	//	for (int Y = center.y - radius; Y <= center.y + radius; Y++) {
-	for (int X = center.x; X <= center.x; X++) {
-		for (int Y = center.y; Y <= center.y; Y++) {
-			if (are_cell_coords_out_of_bounds({ X, Y })) { continue; }
-			//int dx = X - center.x;
-			//int dy = Y - center.y;
-			//float distance_squared = (dx * dx) + (dy * dy);
-
-			//if (distance_squared <= (radius * radius)) {
-				if ((used_cell_grid[X][Y])) {
-					used_cell_grid[X][Y] = false;
-					Cell& cell = this->grid[X][Y];
-					cells_list.push_back(cell);
-				}
-			//}
-		}
-	}
-}
-
-std::vector<Cell> SpatialGrid::raster_line(vec2 line_start, vec2 line_end) // TODO: Add radius parameter
-{
-	std::vector<Cell> cells;
-
-	vec2 line_vector = line_end - line_start;
-	
-	if (line_vector.x <= 0) {
-		line_vector = -line_vector;
-		vec2 holder = line_start;
-		line_start = line_end;
-		line_end = holder;
-	}
-
-	vec2 startRelativePos = line_start / (float)this->cell_size;
-	vec2 endRelativePos = line_end / (float)this->cell_size;
-
-	int lineYSign = (line_vector.y > 0) ? 1 : -1;
-	float slopeM = line_vector.y / line_vector.x;
-
-	ivec2 start_coords = ivec2(floor(startRelativePos.x), floor(startRelativePos.y));
-	ivec2 end_coords = ivec2(floor(endRelativePos.x), floor(endRelativePos.y));
-	int currentY = start_coords.y;
-
-	int testRadius = 0;
-	bool used_cell_grid[NUM_CELLS][NUM_CELLS];
-
-	add_radius_cells(ivec2(start_coords.x, currentY), testRadius, cells, used_cell_grid);
-	
-	for (int X = start_coords.x; X <= end_coords.x - 1; X++) {
-		int Y = (int)floor(slopeM * ((float)X - startRelativePos.x + 1) + startRelativePos.y);
-		if (Y != currentY) {
-			for (int Y0 = currentY + lineYSign; Y0 < INT_MAX; Y0 += lineYSign) {
-				add_radius_cells(ivec2(X, Y0), testRadius, cells, used_cell_grid);
-				if (Y0 == Y) { break; }
-			}
-			currentY = Y;
-		}
-		add_radius_cells(ivec2(X+1, Y), testRadius, cells, used_cell_grid);
-	}
-	if (currentY != end_coords.y) {
-		for (int Y0 = currentY + lineYSign; Y0 < INT_MAX; Y0 += lineYSign) {
-			add_radius_cells(ivec2(end_coords.x, Y0), testRadius, cells, used_cell_grid);
-			if (Y0 == end_coords.y) { break; }
-		}
-	}
+	std::vector<Cell*> cells;
+	for_each_cell_on_line(line_start, line_end, [&](ivec2 cell_coords) { cells.push_back(&get_cell(cell_coords)); });
 	return cells;
 }
 
-std::vector<Cell> SpatialGrid::raster_polygon(ComplexPolygon& polygon, float radius, bool is_only_edge)
+std::vector<Cell*> SpatialGrid::raster_polygon(ComplexPolygon& polygon, float radius, bool is_only_edge)
 {
 	if (is_only_edge) { radius = cell_size; }
 
-	std::vector<Cell> cells;
+	std::vector<Cell*> cells;
 	// First find max extents of polygon:
-	vec2 max_position = { -100000, -100000 };
-	vec2 min_position = { 100000, 100000 };
-	for (uint i = 0; i < polygon.world_edges.size(); i++) {
-		Edge& edge = polygon.world_edges[i];
-		max_position = glm::max(max_position, edge.vertex1);
-		min_position = glm::min(min_position, edge.vertex1);
-		max_position = glm::max(max_position, edge.vertex2);
-		min_position = glm::min(min_position, edge.vertex2);
-	}
-	vec2 size = max_position - min_position;
+	BBox bbox = get_bbox(polygon);
+	vec2 min_position = { bbox.x_low, bbox.y_low };
+	vec2 max_position = { bbox.x_high, bbox.y_high };
 	int expand_amount = ceil(radius/cell_size);
 	ivec2 min_cell = get_grid_cell_coords(min_position) - ivec2(expand_amount);
 	ivec2 max_cell = get_grid_cell_coords(max_position) + ivec2(expand_amount);
@@ -215,7 +358,7 @@ std::vector<Cell> SpatialGrid::raster_polygon(ComplexPolygon& polygon, float rad
 		for (int Y = min_cell.y; Y <= max_cell.y; Y++) {
 			if (are_cell_coords_out_of_bounds({ X, Y })) { continue; }
 			vec2 cell_world_position = vec2(X + 0.5f, Y + 0.5f) * (float)cell_size;
-			Cell& cell = this->grid[X][Y];
+			Cell* cell = &get_cell({ X, Y });
 
 			if (!is_only_edge && is_point_within_polygon(polygon, cell_world_position)) {
 				cells.push_back(cell);
@@ -249,6 +392,11 @@ BBox get_bbox(const Motion& motion)
 	return get_bbox(motion.position, motion.scale, motion.sprite_offset);
 }
 
+BBox get_bbox(const ComplexPolygon& polygon) // Overloaded
+{
+	return polygon.bbox;
+}
+
 bool is_bbox_colliding(BBox bbox1, BBox bbox2)
 {
 	return (bbox1.x_low <= bbox2.x_high && bbox1.x_high >= bbox2.x_low)
@@ -276,6 +424,54 @@ bool is_circle_colliding(const Motion& motion1, const Motion& motion2, float rad
 	return is_circle_colliding(motion1.position, motion1.radius* radius_factor, motion2.position, motion2.radius* radius_factor);
 }
 
+float get_time_of_impact(vec2 start, vec2 displacement, vec2 circle_position, float combined_radius)
+{
+	// Solve |start + t * displacement - circle_position| = combined_radius for the smaller t
+	vec2 separation = start - circle_position;
+	float c = dot(separation, separation) - combined_radius * combined_radius;
+	if (c < 0.f) { return -1.f; } // Already overlapping
+	float a = dot(displacement, displacement);
+	float b = dot(separation, displacement);
+	float discriminant = b * b - a * c;
+	if (a == 0.f || b >= 0.f || discriminant < 0.f) { return -1.f; } // Not moving, moving away or passing by
+	float t = (-b - sqrt(discriminant)) / a;
+	return (t <= 1.f) ? t : -1.f;
+}
+
+void are_circles_colliding(uint count, const float* x1, const float* y1, const float* x2, const float* y2,
+	const float* combined_radii, uint8_t* is_colliding)
+{
+	uint i = 0;
+#if defined(SPATIAL_GRID_AVX)
+	for (; i + 8 <= count; i += 8) {
+		__m256 dist_x = _mm256_sub_ps(_mm256_loadu_ps(x2 + i), _mm256_loadu_ps(x1 + i));
+		__m256 dist_y = _mm256_sub_ps(_mm256_loadu_ps(y2 + i), _mm256_loadu_ps(y1 + i));
+		__m256 dist_squared = _mm256_add_ps(_mm256_mul_ps(dist_x, dist_x), _mm256_mul_ps(dist_y, dist_y));
+		__m256 min_distance = _mm256_loadu_ps(combined_radii + i);
+		int mask = _mm256_movemask_ps(_mm256_cmp_ps(dist_squared, _mm256_mul_ps(min_distance, min_distance), _CMP_LT_OQ));
+		for (int lane = 0; lane < 8; lane++) {
+			is_colliding[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#elif defined(SPATIAL_GRID_SSE2)
+	for (; i + 4 <= count; i += 4) {
+		__m128 dist_x = _mm_sub_ps(_mm_loadu_ps(x2 + i), _mm_loadu_ps(x1 + i));
+		__m128 dist_y = _mm_sub_ps(_mm_loadu_ps(y2 + i), _mm_loadu_ps(y1 + i));
+		__m128 dist_squared = _mm_add_ps(_mm_mul_ps(dist_x, dist_x), _mm_mul_ps(dist_y, dist_y));
+		__m128 min_distance = _mm_loadu_ps(combined_radii + i);
+		int mask = _mm_movemask_ps(_mm_cmplt_ps(dist_squared, _mm_mul_ps(min_distance, min_distance)));
+		for (int lane = 0; lane < 4; lane++) {
+			is_colliding[i + lane] = (mask >> lane) & 1;
+		}
+	}
+#endif
+	for (; i < count; i++) { // Remainder, or everything without SIMD
+		float dist_x = x2[i] - x1[i];
+		float dist_y = y2[i] - y1[i];
+		is_colliding[i] = dist_x * dist_x + dist_y * dist_y < combined_radii[i] * combined_radii[i];
+	}
+}
+
 vec2 is_circle_line_colliding(vec2 circle_pos, float radius, vec2 line_start, vec2 line_end) // Without velocity
 {
 	vec2 line_vector = line_end - line_start;
@@ -316,13 +512,20 @@ vec2 is_circle_line_colliding(vec2 circle_pos, float radius, vec2 velocity, vec2
 
 vec2 is_circle_polygon_colliding(ComplexPolygon& polygon, vec2 circle_pos, float radius) // Without velocity
 {
-	for (uint i = 0; i < polygon.world_edges.size(); i++) {
-		Edge edge = polygon.world_edges[i];
-		if (!edge.is_collidable) { continue; }
-
-		vec2 is_colliding = is_circle_line_colliding(circle_pos, radius, edge.vertex1, edge.vertex2);
-		if (is_colliding.x != 0.f || is_colliding.y != 0.f) {
-			return is_colliding;
+	const PolygonEdges& edges = polygon.edges;
+	for (uint i = 0; i < edges.size(); i++) {
+		if (!edges.is_collidable[i]) { continue; }
+		// Same as is_circle_line_colliding() without velocity, using the precomputed edge data
+		vec2 edge_unit = { edges.unit_x[i], edges.unit_y[i] };
+		vec2 start_to_center_vec = circle_pos - vec2(edges.start_x[i], edges.start_y[i]);
+		vec2 to_nearest_point_vector = start_to_center_vec - edge_unit * clamp(dot(edge_unit, start_to_center_vec), 0.f, edges.lengths[i]);
+		float distance_to_nearest_point = length(to_nearest_point_vector);
+		if (distance_to_nearest_point <= radius) {
+			vec2 edge_normal = { edges.normal_x[i], edges.normal_y[i] };
+			vec2 is_colliding = sign(dot(edge_normal, to_nearest_point_vector)) * edge_normal * distance_to_nearest_point;
+			if (is_colliding.x != 0.f || is_colliding.y != 0.f) {
+				return is_colliding;
+			}
 		}
 	}
 	// If that didn't work, check if it's within the polygon:
@@ -330,25 +533,85 @@ vec2 is_circle_polygon_colliding(ComplexPolygon& polygon, vec2 circle_pos, float
 }
 
 vec2 is_circle_polygon_edge_colliding(ComplexPolygon& polygon, vec2 circle_pos, float radius, vec2 velocity) // With velocity
+{
+	return circle_edges_push(polygon.edges, 0, polygon.edges.size(), circle_pos, radius, velocity);
+}
+
+// Pushes the circle away from each edge it touches, in order since each push changes the velocity used by the next.
+// Finding the touched edges is most of the work, so that part is done 4 edges at a time
+vec2 circle_edges_push(const PolygonEdges& edges, uint first, uint last, vec2 circle_pos, float radius, vec2 velocity)
 {
 	vec2 push_velocity = { 0.f, 0.f };
-	for (uint i = 0; i < polygon.world_edges.size(); i++) {
-		Edge edge = polygon.world_edges[i];
-		if (!edge.is_collidable) { continue; }
+	auto push_edge = [&](uint i) { // Same as is_circle_line_colliding() with velocity
+		vec2 edge_unit = { edges.unit_x[i], edges.unit_y[i] };
+		vec2 start_to_center_vec = circle_pos - vec2(edges.start_x[i], edges.start_y[i]);
+		vec2 to_nearest_point_vector = start_to_center_vec - edge_unit * clamp(dot(edge_unit, start_to_center_vec), 0.f, edges.lengths[i]);
+		float distance_to_nearest_point = length(to_nearest_point_vector);
+		if (distance_to_nearest_point > radius) { return; }
+		float past_line = dot(vec2(edges.normal_x[i], edges.normal_y[i]), to_nearest_point_vector);
+		if (past_line == 0.f || distance_to_nearest_point == 0.f) { return; } // Zero push vector, so not colliding
 
-		push_velocity += is_circle_line_colliding(circle_pos, radius, velocity + push_velocity, edge.vertex1, edge.vertex2);
+		vec2 to_nearest_point_unit = sign(past_line) * vec2(edges.normal_x[i], edges.normal_y[i]);
+		float push_extra = (1.f - distance_to_nearest_point / radius) * 5.f; // Modulate push so we don't phase through lines/polygons
+		float push_amount = max(dot(-(velocity + push_velocity), to_nearest_point_unit), 0.f);
+		push_velocity += to_nearest_point_unit * (push_amount + push_extra * push_extra);
+	};
+	uint i = first;
+#if defined(SPATIAL_GRID_SSE2)
+	// Slightly bigger radius so rounding differences can't skip an edge, push_edge() does the exact test
+	float check_radius = radius * 1.001f + 0.01f;
+	__m128 center_x = _mm_set1_ps(circle_pos.x), center_y = _mm_set1_ps(circle_pos.y);
+	__m128 check_radius_squared = _mm_set1_ps(check_radius * check_radius);
+	__m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= last; i += 4) {
+		__m128 to_center_x = _mm_sub_ps(center_x, _mm_loadu_ps(&edges.start_x[i]));
+		__m128 to_center_y = _mm_sub_ps(center_y, _mm_loadu_ps(&edges.start_y[i]));
+		__m128 unit_x = _mm_loadu_ps(&edges.unit_x[i]), unit_y = _mm_loadu_ps(&edges.unit_y[i]);
+		__m128 dot_on_line = _mm_add_ps(_mm_mul_ps(unit_x, to_center_x), _mm_mul_ps(unit_y, to_center_y));
+		dot_on_line = _mm_min_ps(_mm_max_ps(dot_on_line, zero), _mm_loadu_ps(&edges.lengths[i]));
+		__m128 to_nearest_x = _mm_sub_ps(to_center_x, _mm_mul_ps(unit_x, dot_on_line));
+		__m128 to_nearest_y = _mm_sub_ps(to_center_y, _mm_mul_ps(unit_y, dot_on_line));
+		__m128 distance_squared = _mm_add_ps(_mm_mul_ps(to_nearest_x, to_nearest_x), _mm_mul_ps(to_nearest_y, to_nearest_y));
+		int mask = _mm_movemask_ps(_mm_cmple_ps(distance_squared, check_radius_squared));
+		for (int lane = 0; mask != 0; lane++, mask >>= 1) { // Usually no edge in the block is touched
+			if ((mask & 1) && edges.is_collidable[i + lane]) { push_edge(i + lane); }
+		}
+	}
+#endif
+	for (; i < last; i++) { // Remainder, or everything without SIMD
+		if (edges.is_collidable[i]) { push_edge(i); }
 	}
-	//if (push_velocity.x == 0.f && push_velocity.y == 0.f) {
-	//	//printf("Checking if within polygon\n");
-
-	//	if (!polygon.is_only_edge && is_point_within_polygon(polygon, circle_pos)) {
-	//		printf("It is within polygon\n");
-	//		push_velocity += vec2(-100.f);
-	//	}
-	//}
 	return push_velocity;
 }
 
+// Crossing number test with a ray going right from position. Unlike casting a long ray with get_line_intersection(),
+// a ray through a vertex is only counted once
+bool is_point_within_edges(const PolygonEdges& edges, uint first, uint last, vec2 position)
+{
+	int num_intersections = 0;
+	uint i = first;
+#if defined(SPATIAL_GRID_SSE2)
+	__m128 point_x = _mm_set1_ps(position.x), point_y = _mm_set1_ps(position.y);
+	for (; i + 4 <= last; i += 4) {
+		__m128 start_x = _mm_loadu_ps(&edges.start_x[i]), start_y = _mm_loadu_ps(&edges.start_y[i]);
+		__m128 end_x = _mm_loadu_ps(&edges.end_x[i]), end_y = _mm_loadu_ps(&edges.end_y[i]);
+		__m128 is_straddling = _mm_xor_ps(_mm_cmpgt_ps(start_y, point_y), _mm_cmpgt_ps(end_y, point_y));
+		// Where the edge crosses the ray's line, the division by 0 of flat edges is masked out by is_straddling
+		__m128 crossing_x = _mm_add_ps(start_x, _mm_div_ps(_mm_mul_ps(_mm_sub_ps(point_y, start_y), _mm_sub_ps(end_x, start_x)), _mm_sub_ps(end_y, start_y)));
+		int mask = _mm_movemask_ps(_mm_and_ps(is_straddling, _mm_cmplt_ps(point_x, crossing_x)));
+		num_intersections += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+#endif
+	for (; i < last; i++) {
+		float start_y = edges.start_y[i], end_y = edges.end_y[i];
+		if ((start_y > position.y) == (end_y > position.y)) { continue; }
+		float crossing_x = edges.start_x[i] + (position.y - start_y) * (edges.end_x[i] - edges.start_x[i]) / (end_y - start_y);
+		if (position.x < crossing_x) { num_intersections++; }
+	}
+	// If num_intersections is odd, then point is inside of polygon, else, outside of polygon
+	return ((num_intersections & 1) == 1);
+}
+
 vec2 is_circle_polygon_edge_colliding(ComplexPolygon& polygon, const Motion& motion) // Overloaded
 {
 	return is_circle_polygon_edge_colliding(polygon, motion.position, motion.radius, motion.velocity);
@@ -376,11 +639,11 @@ vec2 get_line_intersection(vec2 p0, vec2 p1, vec2 p2, vec2 p3)
 
 bool is_line_polygon_edge_colliding(ComplexPolygon& polygon, vec2 line_start, vec2 line_end)
 {
-	for (uint i = 0; i < polygon.world_edges.size(); i++) {
-		Edge edge = polygon.world_edges[i];
-		if (!edge.is_collidable) { continue; }
+	const PolygonEdges& edges = polygon.edges;
+	for (uint i = 0; i < edges.size(); i++) {
+		if (!edges.is_collidable[i]) { continue; }
 		// Test if current edge intersects with ray. If yes, increment intersections
-		vec2 collision_point = get_line_intersection(edge.vertex1, edge.vertex2, line_start, line_end);
+		vec2 collision_point = get_line_intersection({ edges.start_x[i], edges.start_y[i] }, { edges.end_x[i], edges.end_y[i] }, line_start, line_end);
 		if (collision_point.x != 0.f || collision_point.y != 0.f) {
 			return true;
 		}
@@ -390,18 +653,9 @@ bool is_line_polygon_edge_colliding(ComplexPolygon& polygon, vec2 line_start, ve
 
 bool is_point_within_polygon(ComplexPolygon& polygon, vec2 position)
 {
-	// Test the ray against all sides
-	int num_intersections = 0;
-	for (uint i = 0; i < polygon.world_edges.size(); i++) {
-		Edge edge = polygon.world_edges[i];
-		// Test if current edge intersects with ray. If yes, increment intersections
-		vec2 collision_point = get_line_intersection(edge.vertex1, edge.vertex2, position, position + vec2(100000, 0));
-		if (collision_point.x != 0.f || collision_point.y != 0.f) {
-			num_intersections++;
-		}
-	}
-	// If num_intersections is odd, then point is inside of polygon, else, outside of polygon
-	return ((num_intersections & 1) == 1);
+	const BBox& bbox = polygon.bbox;
+	if (position.x < bbox.x_low || position.x > bbox.x_high || position.y < bbox.y_low || position.y > bbox.y_high) { return false; }
+	return is_point_within_edges(polygon.edges, 0, polygon.edges.size(), position);
 }
 
 bool is_circle_pie_piece_colliding(vec2 circle_pos, float radius, vec2 pie_center_pos, float angle_min, float angle_max)
@@ -5,21 +5,23 @@
 #include "components.hpp"
 #include "tiny_ecs_registry.hpp"
 
+#include <type_traits>
 
-#define NUM_CELLS 100
-#define MAX_ENTITIES_PER_CELL 20
+
+#define INITIAL_ENTITIES_PER_CELL 4
+#define COARSE_CELL_FACTOR 8 // Fine cells per coarse cell side
 
 struct Cell
 {
-	// High, hard coded upper limit
-	Entity entities[MAX_ENTITIES_PER_CELL] = { NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,
-		NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,NULL_ENTITY,
-		NULL_ENTITY,NULL_ENTITY,NULL_ENTITY }; // How to initialize an array to a value?
-	int num_entities = 0; // How many entities are currently held in the array above
+	// No upper limit. Capacity is kept when the grid is cleared, so moving between cells only allocates the first time a
+	// cell holds more entities than it ever has before
+	std::vector<Entity> entities;
 	ivec2 coords = { 0,0 };
+	int num_sleeping = 0; // Of entities, so moving in only looks for sleepers to wake when there are some
 	Cell() {}
-	Cell(ivec2 coords) : coords(coords) {}
+	Cell(ivec2 coords) : coords(coords) { entities.reserve(INITIAL_ENTITIES_PER_CELL); }
 
+	int num_entities() const { return (int)entities.size(); }
 	void remove_entity(int entity_index);
 	int add_entity(Entity entity);
 
@@ -28,12 +30,125 @@ struct Cell
 	}
 };
 
+// Coarse level cell, keeps the bbox of each entity so queries can skip most of them without touching the registry
+struct CoarseCell
+{
+	std::vector<Entity> entities;
+	std::vector<BBox> bboxes; // Parallel to entities
+};
+
+// Calls func(item), returns false if func asked to stop (func may return void or bool)
+template <typename Func, typename T>
+inline bool visit_item(Func& func, T item) {
+	if constexpr (std::is_same<decltype(func(item)), bool>::value) {
+		return func(item);
+	} else {
+		func(item);
+		return true;
+	}
+}
+
+// Uniform bins over the room holding item indices. Items of bin i are items[first[i]] to items[first[i + 1] - 1] so
+// each bin is one contiguous run. An item is in every bin its bbox touches
+struct StaticBins
+{
+	ivec2 size = { 0,0 };
+	float bin_size = 1.f;
+	std::vector<uint> first;
+	std::vector<uint> items;
+
+	void build(ivec2 new_size, float new_bin_size, const std::vector<BBox>& item_bboxes);
+	// func(uint item) for each item whose bbox (from get_bbox(item)) overlaps query_bbox, each only once
+	template <typename GetBBox, typename Func>
+	bool visit(BBox query_bbox, GetBBox get_bbox, Func& func) const;
+	ivec2 get_bin_coords(vec2 position) const {
+		return glm::clamp(ivec2(glm::floor(position / bin_size)), ivec2(0), size - 1);
+	}
+};
+
+// Colliders that never move (static obstacles and polygons), packed into flat arrays once a room is built so
+// collision tests against them never go through the registry. See SpatialGrid::bake_static_colliders()
+struct StaticColliders
+{
+	// Circles (trees, rocks, camp fires...), all OBSTACLE_MASK
+	std::vector<Entity> circle_entities;
+	std::vector<vec2> circle_positions;
+	std::vector<float> circle_radii;
+
+	// Polygons, the edges of polygon i are polygon_first_edge[i] to polygon_first_edge[i + 1] - 1
+	std::vector<Entity> polygon_entities;
+	std::vector<BBox> polygon_bboxes;
+	std::vector<uint8_t> polygon_is_platform;
+	std::vector<uint> polygon_first_edge = { 0 };
+	PolygonEdges edges; // Copied from each ComplexPolygon::edges
+
+	StaticBins circle_bins; // Fine cells
+	StaticBins polygon_bins; // Coarse cells
+
+	void clear();
+	void add_circle(Entity entity, vec2 position, float radius);
+	void add_polygon(Entity entity, const ComplexPolygon& polygon);
+	void remove(Entity entity); // Leaves the slot in place but it will never be found again
+	uint num_circles() const { return (uint)circle_entities.size(); }
+	uint num_polygons() const { return (uint)polygon_entities.size(); }
+
+	BBox circle_bbox(uint circle) const {
+		vec2 position = circle_positions[circle]; float radius = circle_radii[circle];
+		return { position.x - radius, position.x + radius, position.y - radius, position.y + radius };
+	}
+	// Same results as is_circle_polygon_edge_colliding() and is_point_within_polygon() for ComplexPolygon
+	vec2 circle_polygon_push(uint polygon, vec2 center_pos, float radius, vec2 velocity) const;
+	bool is_point_within_polygon(uint polygon, vec2 position) const;
+
+	// func(uint index) for every circle/polygon whose bbox overlaps query_bbox. func may return false to stop
+	template <typename Func>
+	bool for_each_circle(BBox query_bbox, Func func) const {
+		return circle_bins.visit(query_bbox, [this](uint circle) { return circle_bbox(circle); }, func);
+	}
+	template <typename Func>
+	bool for_each_polygon(BBox query_bbox, Func func) const {
+		return polygon_bins.visit(query_bbox, [this](uint polygon) { return polygon_bboxes[polygon]; }, func);
+	}
+};
+
+template <typename GetBBox, typename Func>
+bool StaticBins::visit(BBox query_bbox, GetBBox get_bbox, Func& func) const
+{
+	if (first.empty()) { return true; } // Not built yet
+	ivec2 min_XY = get_bin_coords({ query_bbox.x_low, query_bbox.y_low });
+	ivec2 max_XY = get_bin_coords({ query_bbox.x_high, query_bbox.y_high });
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			uint bin = X * size.y + Y;
+			for (uint i = first[bin]; i < first[bin + 1]; i++) {
+				uint item = items[i];
+				BBox bbox = get_bbox(item);
+				if (!(bbox.x_low <= query_bbox.x_high && bbox.x_high >= query_bbox.x_low
+					&& bbox.y_low <= query_bbox.y_high && bbox.y_high >= query_bbox.y_low)) { continue; }
+				// Only visit from the bin holding the top left corner of the overlap, see SpatialGrid::visit_coarse_entities()
+				vec2 overlap_min = { glm::max(bbox.x_low, query_bbox.x_low), glm::max(bbox.y_low, query_bbox.y_low) };
+				if (get_bin_coords(overlap_min) != ivec2(X, Y)) { continue; }
+				if (!visit_item(func, item)) return false;
+			}
+		}
+	}
+	return true;
+}
+
 BBox get_bbox(vec2 position, vec2 scale, vec2 sprite_offset = { 0.f,0.f });
 BBox get_bbox(const Motion& motion);
+BBox get_bbox(const ComplexPolygon& polygon);
 bool is_bbox_colliding(const Motion& motion1, const Motion& motion2);
 bool is_bbox_colliding(const BBox bbox1, const BBox bbox2);
 bool is_circle_colliding(const vec2 p1, const float r1, const vec2 p2, const float r2);
 bool is_circle_colliding(const Motion& motion1, const Motion& motion2, float radius_factor = 1.f);
+// Earliest t in [0, 1] at which a circle moving from start by displacement first touches a still circle, -1 if it never
+// does or already overlaps it at t = 0. For two moving circles pass the displacement of one relative to the other
+float get_time_of_impact(vec2 start, vec2 displacement, vec2 circle_position, float combined_radius);
+// Batch version of is_circle_colliding() over SoA lanes: is_colliding[i] = circles at (x1[i], y1[i]) and (x2[i], y2[i])
+// overlap, combined_radii[i] being the sum of their radii. Does 8 (AVX) or 4 (SSE2) pairs at a time when available
+void are_circles_colliding(uint count, const float* x1, const float* y1, const float* x2, const float* y2,
+	const float* combined_radii, uint8_t* is_colliding);
 
 // The below returns a non-zero 'push' vector if there is a collision, zero vector otherwise
 vec2 is_circle_line_colliding(vec2 center_pos, float radius, vec2 line_start, vec2 line_end); // Without velocity
@@ -46,6 +161,10 @@ vec2 get_line_intersection(vec2 p0, vec2 p1, vec2 p2, vec2 p3);
 bool is_point_within_polygon(ComplexPolygon& polygon, vec2 position);
 bool is_line_polygon_edge_colliding(ComplexPolygon& polygon, vec2 line_start, vec2 line_end);
 
+// Kernels over edges first to last - 1, 4 edges at a time with SSE2. The polygon versions above use these
+vec2 circle_edges_push(const PolygonEdges& edges, uint first, uint last, vec2 circle_pos, float radius, vec2 velocity);
+bool is_point_within_edges(const PolygonEdges& edges, uint first, uint last, vec2 position);
+
 bool box_intersects(vec2 start, vec2 stop, Motion& motion);
 
 // Unfinished and possibly unnecessary:
@@ -60,35 +179,282 @@ public:
         return instance;			 // Instantiated on first use.
     }
 
-	int num_cells = NUM_CELLS;
 	int cell_size = 100;
-	Cell grid[NUM_CELLS][NUM_CELLS];
+	ivec2 grid_size = { 0,0 }; // Matches Room::grid_size, see resize()
+	std::vector<Cell> grid; // Column major (grid_size.y cells per column), use get_cell()
+
+	// Second, coarse level for large static colliders (polygons and big obstacles). They are added once per coarse cell
+	// their bbox touches instead of being rasterized into every fine cell. All queries below visit both levels
+	static const int LARGE_ENTITY_INDEX = -1; // Motion::cell_index of entities in the coarse level
+	ivec2 coarse_grid_size = { 0,0 };
+	std::vector<CoarseCell> coarse_grid; // Column major like grid
+
+	// Static obstacles and polygons of the current room, moved out of both levels by bake_static_colliders() once the
+	// room is built. Anything created afterwards (e.g. chests) just stays in the levels above
+	static const int BAKED_ENTITY_INDEX = -2; // Motion::cell_index of baked entities
+	StaticColliders static_colliders;
+	void bake_static_colliders();
+
+	// Called when a room is created. Also clears all cells
+	void resize(ivec2 new_grid_size);
+	Cell& get_cell(ivec2 cell_coords) {
+		assert(!are_cell_coords_out_of_bounds(cell_coords));
+		return this->grid[cell_coords.x * grid_size.y + cell_coords.y];
+	}
 
 	int add_entity_to_cell(ivec2 cell_coords, Entity entity);
 	void remove_entity_from_cell(ivec2 cell_coords, int entity_index, Entity e);
+	// Keeps Cell::num_sleeping up to date, call when a motion falls asleep (change 1) or wakes up (change -1)
+	void count_sleeping(const Motion& motion, int change) {
+		if (motion.cell_index >= 0 && motion.cell_index != INT_MAX) { get_cell(motion.cell_coords).num_sleeping += change; }
+	}
 	void clear_all_cells();
 	void check_all_cells();
 
+	bool is_large(float radius) const { return radius > cell_size / 2.f; } // Static obstacles bigger than this go coarse
+	void add_large_entity(Entity entity, BBox bbox);
+	void remove_large_entity(Entity entity);
+
 	bool are_cell_coords_out_of_bounds(ivec2 cell_coords);
 	ivec2 get_grid_cell_coords(vec2 position);
+	ivec2 get_coarse_cell_coords(vec2 position);
+
+	// Allocation free queries: func(Entity) is called for every entity in the covered cells, then for every coarse level
+	// and baked entity whose bbox overlaps the query (each only once). func may return false to stop the query early
+	// (e.g. once something is hit). Don't add or remove entities from the grid inside func
+	template <typename Func>
+	void for_each_in_rect(ivec2 min_XY, ivec2 max_XY, Func func);
+	template <typename Func>
+	void for_each_live_in_rect(ivec2 min_XY, ivec2 max_XY, Func func); // Skips the baked static colliders
+	template <typename Func>
+	void for_each_in_radius(ivec2 center_cell, float radius, Func func);
+	template <typename Func>
+	void for_each_on_ray(vec2 line_start, vec2 line_end, Func func);
+	// for_each_on_ray() that skips the entities of the cells is_cell_wanted(ivec2 cell_coords) turns down. If it wants none
+	// of the cells on the line, the coarse and baked entities are skipped too, so the filter has to cover those as well
+	template <typename Filter, typename Func>
+	void for_each_on_ray_in_cells(vec2 line_start, vec2 line_end, Filter is_cell_wanted, Func func);
+	// Widened for_each_on_ray() for a circle moving along the line: the cells the swept circle can touch (centers within
+	// radius + half a cell diagonal of the line), then coarse level and baked entities overlapping its bbox
+	template <typename Func>
+	void for_each_on_swept_circle(vec2 line_start, vec2 line_end, float radius, Func func);
+	// Lazy raster of the cells a line passes through, in order from the line's leftmost end. func(ivec2 cell_coords)
+	template <typename Func>
+	void for_each_cell_on_line(vec2 line_start, vec2 line_end, Func func);
+
+	// These fill a caller owned buffer (cleared first), keep the buffer around between calls to avoid allocating
+	void query_rect(ivec2 min_XY, ivec2 bottom_right_max_XY, std::vector<Entity>& entities_found);
+	void query_radius(ivec2 center_cell, float radius, std::vector<Entity>& entities_found);
+	void query_ray_cast(vec2 line_start, vec2 line_end, std::vector<Entity>& entities_found);
 	std::vector<Entity> query_rect(ivec2 min_XY, ivec2 bottom_right_max_XY);
 	std::vector<Entity> query_radius(ivec2 center_cell, float radius);
 	std::vector<Entity> query_ray_cast(vec2 line_start, vec2 line_end);
 
-	void add_radius_cells(ivec2 center, int radius, std::vector<Cell>& cells_list, bool used_cell_grid[NUM_CELLS][NUM_CELLS]);
-	std::vector<Cell> raster_line(vec2 line_start, vec2 line_end);
-	std::vector<Cell> raster_polygon(ComplexPolygon& polygon, float radius, bool is_only_edge = false);
+	// The returned pointers point into the grid, they stay valid until the next resize()
+	std::vector<Cell*> raster_line(vec2 line_start, vec2 line_end);
+	std::vector<Cell*> raster_polygon(ComplexPolygon& polygon, float radius, bool is_only_edge = false);
 
 private:
     SpatialGrid() {
-        printf("Initializing new Spatial Grid\n");
-		for (int X = 0; X < NUM_CELLS; X++) {
-			for (int Y = 0; Y < NUM_CELLS; Y++) {
-				this->grid[X][Y] = Cell({ X, Y });
-			}
-		}
+        printf("Initializing new Spatial Grid\n"); // Cells are only created once a room sets the size
     }
 
     SpatialGrid(SpatialGrid const&); // Don't Implement to avoid making copies
     void operator=(SpatialGrid const&); // Don't implement
-};
\ No newline at end of file
+
+	// Calls func on each entity in the cell, returns false if func asked to stop
+	template <typename Func>
+	static bool visit_cell_entities(Cell& cell, Func& func) {
+		for (Entity entity : cell.entities) {
+			if (!visit_item(func, entity)) return false;
+		}
+		return true;
+	}
+	template <typename Func>
+	bool visit_live_in_rect(ivec2 min_XY, ivec2 max_XY, Func& func);
+	template <typename Func>
+	bool visit_coarse_entities(BBox query_bbox, Func& func);
+	template <typename Func>
+	bool visit_static_entities(BBox query_bbox, Func& func) {
+		StaticColliders& statics = this->static_colliders;
+		return statics.for_each_circle(query_bbox, [&](uint circle) { return visit_item(func, statics.circle_entities[circle]); })
+			&& statics.for_each_polygon(query_bbox, [&](uint polygon) { return visit_item(func, statics.polygon_entities[polygon]); });
+	}
+};
+
+template <typename Func>
+bool SpatialGrid::visit_coarse_entities(BBox query_bbox, Func& func)
+{
+	ivec2 min_XY = glm::max(get_coarse_cell_coords({ query_bbox.x_low, query_bbox.y_low }), ivec2(0));
+	ivec2 max_XY = glm::min(get_coarse_cell_coords({ query_bbox.x_high, query_bbox.y_high }), this->coarse_grid_size - 1);
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			CoarseCell& cell = this->coarse_grid[X * coarse_grid_size.y + Y];
+			for (uint i = 0; i < cell.entities.size(); i++) {
+				const BBox& bbox = cell.bboxes[i];
+				if (!is_bbox_colliding(bbox, query_bbox)) { continue; }
+				// An entity is in every coarse cell its bbox touches, so only visit it from the one holding the top left
+				// corner of the overlap
+				vec2 overlap_min = { glm::max(bbox.x_low, query_bbox.x_low), glm::max(bbox.y_low, query_bbox.y_low) };
+				ivec2 owner_XY = glm::clamp(get_coarse_cell_coords(overlap_min), ivec2(0), this->coarse_grid_size - 1);
+				if (owner_XY != ivec2(X, Y)) { continue; }
+				if (!visit_item(func, cell.entities[i])) return false;
+			}
+		}
+	}
+	return true;
+}
+
+template <typename Func>
+bool SpatialGrid::visit_live_in_rect(ivec2 min_XY, ivec2 max_XY, Func& func)
+{
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			if (!visit_cell_entities(this->grid[X * grid_size.y + Y], func)) return false;
+		}
+	}
+	vec2 world_min = vec2(min_XY) * (float)cell_size;
+	vec2 world_max = vec2(max_XY + 1) * (float)cell_size;
+	return visit_coarse_entities({ world_min.x, world_max.x, world_min.y, world_max.y }, func);
+}
+
+template <typename Func>
+void SpatialGrid::for_each_in_rect(ivec2 min_XY, ivec2 max_XY, Func func)
+{
+	// Clamp to the grid once instead of bounds checking every cell
+	min_XY = glm::max(min_XY, ivec2(0));
+	max_XY = glm::min(max_XY, this->grid_size - 1);
+	if (min_XY.x > max_XY.x || min_XY.y > max_XY.y) { return; } // Entirely outside of the grid
+	if (!visit_live_in_rect(min_XY, max_XY, func)) { return; }
+	vec2 world_min = vec2(min_XY) * (float)cell_size;
+	vec2 world_max = vec2(max_XY + 1) * (float)cell_size;
+	visit_static_entities({ world_min.x, world_max.x, world_min.y, world_max.y }, func);
+}
+
+template <typename Func>
+void SpatialGrid::for_each_live_in_rect(ivec2 min_XY, ivec2 max_XY, Func func)
+{
+	min_XY = glm::max(min_XY, ivec2(0));
+	max_XY = glm::min(max_XY, this->grid_size - 1);
+	if (min_XY.x > max_XY.x || min_XY.y > max_XY.y) { return; }
+	visit_live_in_rect(min_XY, max_XY, func);
+}
+
+template <typename Func>
+void SpatialGrid::for_each_in_radius(ivec2 center_cell, float radius, Func func)
+{
+	ivec2 cell_radius_cells = ivec2(ceil(radius / this->cell_size));
+	for_each_in_rect(center_cell - cell_radius_cells, center_cell + cell_radius_cells, func);
+}
+
+template <typename Func>
+void SpatialGrid::for_each_on_ray(vec2 line_start, vec2 line_end, Func func) // TODO: Add radius here too
+{
+	bool is_stopped = false;
+	for_each_cell_on_line(line_start, line_end, [&](ivec2 cell_coords) {
+		if (!is_stopped) is_stopped = !visit_cell_entities(get_cell(cell_coords), func);
+	});
+	if (is_stopped) { return; }
+	// Coarse and baked entities are only tested against the ray's bbox, func is expected to do the exact test
+	vec2 min_position = glm::min(line_start, line_end);
+	vec2 max_position = glm::max(line_start, line_end);
+	BBox line_bbox = { min_position.x, max_position.x, min_position.y, max_position.y };
+	if (visit_coarse_entities(line_bbox, func)) {
+		visit_static_entities(line_bbox, func);
+	}
+}
+
+template <typename Filter, typename Func>
+void SpatialGrid::for_each_on_ray_in_cells(vec2 line_start, vec2 line_end, Filter is_cell_wanted, Func func)
+{
+	bool is_stopped = false;
+	bool is_any_wanted = false;
+	for_each_cell_on_line(line_start, line_end, [&](ivec2 cell_coords) {
+		if (is_stopped || !is_cell_wanted(cell_coords)) { return; }
+		is_any_wanted = true;
+		is_stopped = !visit_cell_entities(get_cell(cell_coords), func);
+	});
+	if (is_stopped || !is_any_wanted) { return; }
+	vec2 min_position = glm::min(line_start, line_end);
+	vec2 max_position = glm::max(line_start, line_end);
+	BBox line_bbox = { min_position.x, max_position.x, min_position.y, max_position.y };
+	if (visit_coarse_entities(line_bbox, func)) {
+		visit_static_entities(line_bbox, func);
+	}
+}
+
+template <typename Func>
+void SpatialGrid::for_each_on_swept_circle(vec2 line_start, vec2 line_end, float radius, Func func)
+{
+	vec2 min_position = glm::min(line_start, line_end) - radius;
+	vec2 max_position = glm::max(line_start, line_end) + radius;
+	ivec2 min_XY = glm::max(get_grid_cell_coords(min_position), ivec2(0));
+	ivec2 max_XY = glm::min(get_grid_cell_coords(max_position), this->grid_size - 1);
+
+	vec2 line_vector = line_end - line_start;
+	float line_length_squared = dot(line_vector, line_vector);
+	float reach = radius + this->cell_size * 0.7071f;
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			vec2 cell_center = (vec2(X, Y) + 0.5f) * (float)this->cell_size;
+			float t = (line_length_squared > 0.f)
+				? glm::clamp(dot(cell_center - line_start, line_vector) / line_length_squared, 0.f, 1.f) : 0.f;
+			vec2 to_line = line_start + t * line_vector - cell_center;
+			if (dot(to_line, to_line) > reach * reach) { continue; } // Only the corner of the bbox, away from the line
+			if (!visit_cell_entities(this->grid[X * grid_size.y + Y], func)) return;
+		}
+	}
+	BBox swept_bbox = { min_position.x, max_position.x, min_position.y, max_position.y };
+	if (visit_coarse_entities(swept_bbox, func)) {
+		visit_static_entities(swept_bbox, func);
+	}
+}
+
+template <typename Func>
+void SpatialGrid::for_each_cell_on_line(vec2 line_start, vec2 line_end, Func func) // TODO: Add radius parameter
+{
+	vec2 line_vector = line_end - line_start;
+
+	if (line_vector.x <= 0) {
+		line_vector = -line_vector;
+		vec2 holder = line_start;
+		line_start = line_end;
+		line_end = holder;
+	}
+
+	vec2 startRelativePos = line_start / (float)this->cell_size;
+	vec2 endRelativePos = line_end / (float)this->cell_size;
+
+	int lineYSign = (line_vector.y > 0) ? 1 : -1;
+	float slopeM = line_vector.y / line_vector.x;
+
+	ivec2 start_coords = ivec2(floor(startRelativePos.x), floor(startRelativePos.y));
+	ivec2 end_coords = ivec2(floor(endRelativePos.x), floor(endRelativePos.y));
+	int min_Y = glm::min(start_coords.y, end_coords.y);
+	int max_Y = glm::max(start_coords.y, end_coords.y);
+	int currentY = start_coords.y;
+
+	// The walk only ever moves forward (in X and in lineYSign), so no cell is visited twice
+	auto visit = [&](ivec2 cell_coords) {
+		if (!are_cell_coords_out_of_bounds(cell_coords)) func(cell_coords);
+	};
+	auto walk_column = [&](int X, int to_Y) { // Visits the cells after currentY up to and including to_Y
+		for (int Y0 = currentY + lineYSign; (to_Y - Y0) * lineYSign >= 0; Y0 += lineYSign) {
+			visit(ivec2(X, Y0));
+		}
+		currentY = to_Y;
+	};
+
+	visit(start_coords);
+	for (int X = start_coords.x; X <= end_coords.x - 1; X++) {
+		// Clamped since nearly vertical lines have a huge slope
+		int Y = glm::clamp((int)floor(slopeM * ((float)X - startRelativePos.x + 1) + startRelativePos.y), min_Y, max_Y);
+		if (Y != currentY) {
+			walk_column(X, Y);
+		}
+		visit(ivec2(X + 1, Y));
+	}
+	if (currentY != end_coords.y) {
+		walk_column(end_coords.x, end_coords.y);
+	}
+}
\ No newline at end of file
@@ -1,5 +1,35 @@
 // internal
 #include "tiny_ecs.hpp"
 
+#include <cstdio>
+#include <cstdlib>
+
 // All we need to store besides the containers is the id of every entity and callbacks to be able to remove entities across containers
-unsigned int Entity::id_count = 1;
\ No newline at end of file
+unsigned int Entity::id_count = 1;
+
+std::deque<unsigned int>& Entity::free_indices()
+{
+	static std::deque<unsigned int> free_list;
+	return free_list;
+}
+
+std::vector<unsigned short>& Entity::generations()
+{
+	static std::vector<unsigned short> gens;
+	return gens;
+}
+
+void Entity::out_of_indices()
+{
+	fprintf(stderr, "Ran out of entity indices, %u entities are alive\n", id_count - (unsigned int)free_indices().size());
+	abort();
+}
+
+void Entity::release(Entity e)
+{
+	if (!e.is_alive()) return; // Already released (e.g. removed twice in the same frame)
+	std::vector<unsigned short>& gens = generations();
+	if (e.index() >= gens.size()) gens.resize(e.index() + 1, 0);
+	gens[e.index()] = (unsigned short)((gens[e.index()] + 1) & GENERATION_MASK);
+	free_indices().push_back(e.index());
+}
\ No newline at end of file
@@ -2,25 +2,58 @@
 
 #include <algorithm>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <set>
 #include <functional>
 #include <typeindex>
+#include <tuple>
+#include <cstdint>
 #include <assert.h>
+#include <climits>
 
 // Unique identifyer for all entities
+// The id packs an index (low bits) and a generation (high bits). Indices of deleted entities are re-used once enough
+// of them have been freed, and the generation is bumped each time so stale handles (e.g. Enemy::target) can be detected
 class Entity
 {
 private:
+	static constexpr unsigned int INDEX_BITS = 20; // Up to ~1M entities alive at once
+	static constexpr unsigned int INDEX_MASK = (1u << INDEX_BITS) - 1;
+	static constexpr unsigned int GENERATION_MASK = (1u << (32 - INDEX_BITS)) - 1;
+	static constexpr unsigned int MINIMUM_FREE_INDICES = 1024; // Delays re-use so one index doesn't cycle through its generations too fast
+
 	static unsigned int id_count; // starts from 1, entity 0 is the default initialization
+	static std::deque<unsigned int>& free_indices(); // Function-local statics since Entities are created during static init
+	static std::vector<unsigned short>& generations();
+	[[noreturn]] static void out_of_indices(); // Handles would alias if the index wrapped, so this ends the game
+	static unsigned int generation_of(unsigned int index) {
+		std::vector<unsigned short>& gens = generations();
+		return (index < gens.size()) ? gens[index] : 0;
+	}
 	unsigned int id;
 public:
 
 	Entity()
 	{
-		id = ++id_count;
-		// Note, indices of already deleted entities arent re-used in this simple implementation.
+		std::deque<unsigned int>& free_list = free_indices();
+		if (free_list.size() > MINIMUM_FREE_INDICES) {
+			unsigned int index = free_list.front();
+			free_list.pop_front();
+			id = (generation_of(index) << INDEX_BITS) | index;
+		} else {
+			if (id_count >= INDEX_MASK) out_of_indices();
+			id = ++id_count;
+		}
 	}
+	unsigned int index() const { return id & INDEX_MASK; } // Use this (not the full id) to index into dense arrays
+	unsigned int generation() const { return id >> INDEX_BITS; }
+	static unsigned int num_indices() { return id_count; } // Handed out so far, re-used ones counted once
+	bool is_alive() const { return generation_of(index()) == generation(); }
+
+	// Marks the entity as deleted and queues its index for re-use. Releasing a stale handle does nothing
+	static void release(Entity e);
+
 	operator unsigned int() { return id; } // this enables automatic casting to int
 	friend bool operator==(Entity lhs, Entity rhs) {
 		return lhs.id == rhs.id;
@@ -30,6 +63,9 @@ public:
 	}
 };
 
+// One bit per component type, set if an entity has that component (see ECSRegistry::signatures)
+typedef uint64_t Signature;
+
 // Common interface to refer to all containers in the ECS registry
 struct ContainerInterface
 {
@@ -37,6 +73,11 @@ struct ContainerInterface
 	virtual size_t size() = 0;
 	virtual void remove(Entity e) = 0;
 	virtual bool has(Entity entity) = 0;
+	virtual void append_entities(std::vector<Entity>& found) = 0; // Adds the handles of every entity with a component
+
+	// Set by the ECSRegistry. Containers keep the bit of their type in each entity's signature up to date
+	Signature signature_bit = 0;
+	std::vector<Signature>* signatures = nullptr;
 };
 
 // A container that stores components of type 'Component' and associated entities
@@ -44,9 +85,102 @@ template <typename Component> // A component can be any class
 class ComponentContainer : public ContainerInterface
 {
 private:
-	// The hash map from Entity -> array index.
-	std::unordered_map<unsigned int, unsigned int> map_entity_componentID; // the entity is cast to uint to be hashable.
+	// Paged sparse array from Entity index -> array index. Pages are only allocated once an entity index in their range is
+	// inserted, so lookups are a divide, a mod and two array reads instead of a hash. The generation is checked against
+	// the entities vector so a stale handle never resolves to whichever entity re-used its index.
+	static constexpr unsigned int SPARSE_PAGE_SIZE = 1024;
+	static constexpr unsigned int INVALID_INDEX = UINT_MAX;
+	std::vector<std::vector<unsigned int>> sparse_pages;
 	bool registered = false;
+
+	unsigned int* sparse_slot(Entity e) { // Returns nullptr if the page for this index was never allocated
+		unsigned int page = e.index() / SPARSE_PAGE_SIZE;
+		if (page >= sparse_pages.size() || sparse_pages[page].empty()) return nullptr;
+		return &sparse_pages[page][e.index() % SPARSE_PAGE_SIZE];
+	}
+	unsigned int& sparse_slot_or_allocate(Entity e) {
+		unsigned int page = e.index() / SPARSE_PAGE_SIZE;
+		if (page >= sparse_pages.size()) sparse_pages.resize(page + 1);
+		if (sparse_pages[page].empty()) sparse_pages[page].assign(SPARSE_PAGE_SIZE, INVALID_INDEX);
+		return sparse_pages[page][e.index() % SPARSE_PAGE_SIZE];
+	}
+	void set_signature_bit(Entity e) {
+		if (signatures == nullptr) return;
+		if (e.index() >= signatures->size()) signatures->resize(e.index() + 1, 0);
+		(*signatures)[e.index()] |= signature_bit;
+	}
+	void reset_signature_bit(Entity e) {
+		if (signatures != nullptr) (*signatures)[e.index()] &= ~signature_bit;
+	}
+
+	// Scratch permutation for sort(), kept between sorts so sorting doesn't allocate
+	std::vector<unsigned int> sort_order;
+	// Set by keep_sorted_by(). If set, insert and remove keep the components ordered by this key
+	std::function<int(const Component&)> sorted_key;
+
+	void swap_elements(unsigned int a, unsigned int b) {
+		std::swap(components[a], components[b]);
+		std::swap(entities[a], entities[b]);
+		*sparse_slot(entities[a]) = a;
+		*sparse_slot(entities[b]) = b;
+	}
+	// Index of the first component in [0, end) with the given key. Requires [0, end) to be sorted
+	unsigned int first_with_key(int key, unsigned int end) {
+		return (unsigned int)(std::lower_bound(components.begin(), components.begin() + end, key,
+			[&](const Component& c, int value) { return sorted_key(c) < value; }) - components.begin());
+	}
+	// One past the last component in [begin, size) with the given key. Requires [begin, size) to be sorted
+	unsigned int end_of_key(int key, unsigned int begin) {
+		return (unsigned int)(std::upper_bound(components.begin() + begin, components.end(), key,
+			[&](int value, const Component& c) { return value < sorted_key(c); }) - components.begin());
+	}
+	// Components with equal keys can be in any order, so the new component at the back only has to swap with the first
+	// component of each group of larger keys (instead of shifting every larger component up by one)
+	unsigned int move_into_sorted_place(unsigned int index) {
+		int key = sorted_key(components[index]);
+		while (index > 0) {
+			int previous_key = sorted_key(components[index - 1]);
+			if (previous_key <= key) break;
+			unsigned int group_start = first_with_key(previous_key, index - 1);
+			swap_elements(index, group_start);
+			index = group_start;
+		}
+		return index;
+	}
+	// The reverse of the above: walks the component to the back with one swap per group of keys after it
+	void move_to_back_keeping_order(unsigned int index) {
+		unsigned int group_end = end_of_key(sorted_key(components[index]), index);
+		swap_elements(index, group_end - 1);
+		index = group_end - 1;
+		while (index + 1 < components.size()) {
+			group_end = end_of_key(sorted_key(components[index + 1]), index + 1);
+			swap_elements(index, group_end - 1);
+			index = group_end - 1;
+		}
+	}
+	// Moves every component (and entity) to position i from sort_order[i] by following the cycles of the permutation, so
+	// each component is moved once and only one temporary is needed per cycle
+	void apply_sort_order() {
+		for (unsigned int i = 0; i < sort_order.size(); i++) {
+			if (sort_order[i] == i) continue;
+			Component held = std::move(components[i]);
+			Entity held_entity = entities[i];
+			unsigned int j = i;
+			while (sort_order[j] != i) {
+				unsigned int next = sort_order[j];
+				components[j] = std::move(components[next]);
+				entities[j] = entities[next];
+				sort_order[j] = j;
+				j = next;
+			}
+			components[j] = std::move(held);
+			entities[j] = held_entity;
+			sort_order[j] = j;
+		}
+		// Fill the new sparse index
+		for (unsigned int i = 0; i < entities.size(); i++)
+			*sparse_slot(entities[i]) = i;
+	}
 public:
 	// Container of all components of type 'Component'
 	std::vector<Component> components;
@@ -66,10 +200,14 @@ public:
 		if (check_for_duplicates && has(e)) {
 			assert(!(check_for_duplicates && has(e)) && "Entity already contained in ECS registry");
 		}  // Put breakpoint one line above to better debug
+		assert(e.is_alive() && "Inserting a component for a deleted entity");
 
-		map_entity_componentID[e] = (unsigned int)components.size();
+		sparse_slot_or_allocate(e) = (unsigned int)components.size();
+		set_signature_bit(e);
 		components.push_back(std::move(c)); // the move enforces move instead of copy constructor
 		entities.push_back(e);
+		if (sorted_key)
+			return components[move_into_sorted_place((unsigned int)components.size() - 1)];
 		return components.back();
 	};
 
@@ -88,7 +226,7 @@ public:
 		if (!has(e)) {
  			assert(has(e) && "Entity not contained in ECS registry"); // Put breakpoint here to better debug
 		}
-		return components[map_entity_componentID[e]];
+		return components[*sparse_slot(e)];
 	}
 
 	// A wrapper to return the component/entities index of an entity
@@ -96,12 +234,25 @@ public:
 		if (!has(e)) {
 			assert(has(e) && "Entity not contained in ECS registry"); // Put breakpoint here to better debug
 		}
-		return map_entity_componentID[e];
+		return *sparse_slot(e);
+	}
+
+	// Returns the component of an entity or nullptr if it has none. Does has() and get() with a single lookup
+	Component* find(Entity e) {
+		unsigned int* slot = sparse_slot(e);
+		if (slot == nullptr || *slot == INVALID_INDEX || entities[*slot] != e) return nullptr;
+		return &components[*slot];
+	}
+
+	// Like get() without the checks, for an entity whose signature already says it has this component (see View)
+	Component& get_known(Entity e) {
+		return components[*sparse_slot(e)];
 	}
 
 	// Check if entity has a component of type 'Component'
 	bool has(Entity entity) {
-		return map_entity_componentID.count(entity) > 0;
+		unsigned int* slot = sparse_slot(entity);
+		return slot != nullptr && *slot != INVALID_INDEX && entities[*slot] == entity;
 	}
 
 	// Remove an component and pack the container to re-use the empty space
@@ -109,31 +260,43 @@ public:
 	{
 		if (has(e))
 		{
+			if (sorted_key)
+				move_to_back_keeping_order(*sparse_slot(e));
+
 			// Get the current position
-			int cID = map_entity_componentID[e];
+			unsigned int& slot = *sparse_slot(e);
+			unsigned int cID = slot;
 
 			// Move the last element to position cID using the move operator
 			// Note, components[cID] = components.back() would trigger the copy instead of move operator
 			components[cID] = std::move(components.back());
 			entities[cID] = entities.back(); // the entity is only a single index, copy it.
-			map_entity_componentID[entities.back()] = cID;
+			*sparse_slot(entities.back()) = cID;
 
 			// Erase the old component and free its memory
-			map_entity_componentID.erase(e);
+			slot = INVALID_INDEX;
+			reset_signature_bit(e);
 			components.pop_back();
 			entities.pop_back();
-			// Note, one could mark the id for re-use
 		}
 	};
 
 	// Remove all components of type 'Component'
 	void clear()
 	{
-		map_entity_componentID.clear();
+		for (Entity e : entities) { // Only reset the slots in use so the pages can be re-used by the next room
+			*sparse_slot(e) = INVALID_INDEX;
+			reset_signature_bit(e);
+		}
 		components.clear();
 		entities.clear();
 	}
 
+	void append_entities(std::vector<Entity>& found)
+	{
+		found.insert(found.end(), entities.begin(), entities.end());
+	}
+
 	// Report the number of components of type 'Component'
 	size_t size()
 	{
@@ -141,17 +304,125 @@ public:
 	}
 
 	// Sort the components and associated entity assignment structures by the comparisonFunction, see std::sort
+	// Components that compare equal keep their current order
 	template <class Compare>
 	void sort(Compare comparisonFunction)
 	{
-		// First sort the entity list as desired
-		std::sort(entities.begin(), entities.end(), comparisonFunction);
-		// Now re-arrange the components (Note, creates a new vector, which may be slow! Not sure if in-place could be faster: https://stackoverflow.com/questions/63703637/how-to-efficiently-permute-an-array-in-place-using-stdswap)
-		std::vector<Component> components_new; components_new.reserve(components.size());
-		std::transform(entities.begin(), entities.end(), std::back_inserter(components_new), [&](Entity e) { return std::move(get(e)); }); // note, the get still uses the old hash map (on purpose!)
-		components = std::move(components_new); // note, we use move operations to not create unneccesary copies of objects, but memory is still allocated for the new vector
-		// Fill the new hashmap
-		for (unsigned int i = 0; i < entities.size(); i++)
-			map_entity_componentID[entities[i]] = i;
+		// Sort a permutation instead of the entities, the sparse index stays valid for comparisonFunction while sorting
+		sort_order.resize(entities.size());
+		for (unsigned int i = 0; i < sort_order.size(); i++) sort_order[i] = i;
+		std::sort(sort_order.begin(), sort_order.end(), [&](unsigned int a, unsigned int b) {
+			if (comparisonFunction(entities[a], entities[b])) return true;
+			return !comparisonFunction(entities[b], entities[a]) && a < b;
+		});
+		apply_sort_order();
+	}
+
+	// Sort by a key projected from each component, e.g. sort_by_key([](const RenderRequest& r) { return (int)r.diffuse_id; })
+	// Cheaper than sort() since the key is read straight from the components instead of through the sparse index
+	template <class Key>
+	void sort_by_key(Key key)
+	{
+		sort_order.resize(components.size());
+		for (unsigned int i = 0; i < sort_order.size(); i++) sort_order[i] = i;
+		std::sort(sort_order.begin(), sort_order.end(), [&](unsigned int a, unsigned int b) {
+			auto key_a = key(components[a]);
+			auto key_b = key(components[b]);
+			return key_a < key_b || (!(key_b < key_a) && a < b);
+		});
+		apply_sort_order();
+	}
+
+	// Sorts by key now and keeps the container sorted on every insert and remove, at the cost of about one swap per
+	// distinct key. Changing a component's key after inserting it is not tracked, call restore_sorted_order() for that
+	// Pass nullptr to go back to unordered inserts and swap-and-pop removal
+	void keep_sorted_by(std::function<int(const Component&)> key)
+	{
+		sorted_key = key;
+		if (sorted_key)
+			sort_by_key(sorted_key);
+	}
+
+	// Re-sorts if a key was changed in place since keep_sorted_by(). Only a pass over the keys when none was, so it can be
+	// called every frame
+	void restore_sorted_order()
+	{
+		if (!sorted_key) return;
+		for (unsigned int i = 1; i < components.size(); i++) {
+			if (sorted_key(components[i]) < sorted_key(components[i - 1])) {
+				sort_by_key(sorted_key);
+				return;
+			}
+		}
 	}
 };
+
+// Iterates all entities that have every one of the given component types, yielding (entity, component&...) tuples:
+//     for (auto [entity, motion, render_request] : registry.view<Motion, RenderRequest>()) { ... }
+// Iteration is driven by the smallest container (ties go to the first listed type, so list the container whose order
+// matters first, e.g. the sorted renderRequests). Adding/removing components of these types while iterating is unsafe.
+template <typename... Components>
+class View
+{
+	static_assert(sizeof...(Components) > 0, "A view needs at least one component type");
+	std::tuple<ComponentContainer<Components>*...> containers;
+	std::vector<Entity>* driver_entities = nullptr;
+	// Entities of the driver are first filtered with their signature so non-matching ones cost no lookups
+	std::vector<Signature>* signatures = nullptr;
+	Signature required = 0;
+
+	// True if the entity has every component, from its signature when the containers are in a registry
+	bool matches(Entity e) {
+		if (signatures == nullptr) return (std::get<ComponentContainer<Components>*>(containers)->has(e) && ...);
+		return ((*signatures)[e.index()] & required) == required;
+	}
+	// The component of a matching entity, found at index if the container is the driver
+	template <typename Component>
+	Component& fetch(ComponentContainer<Component>* container, Entity e, size_t index) {
+		if (&container->entities == driver_entities) return container->components[index];
+		return (signatures == nullptr) ? container->get(e) : container->get_known(e);
+	}
+public:
+	View(ComponentContainer<Components>&... containers_in) : containers(&containers_in...)
+	{
+		signatures = std::get<0>(containers)->signatures;
+		required = (containers_in.signature_bit | ...);
+		size_t smallest = SIZE_MAX;
+		auto pick_if_smaller = [&](auto& container) {
+			if (container.size() < smallest) { smallest = container.size(); driver_entities = &container.entities; }
+		};
+		(pick_if_smaller(containers_in), ...);
+	}
+
+	class Iterator
+	{
+		View* view;
+		size_t index;
+
+		void skip_unmatched() {
+			while (index < view->driver_entities->size() && !view->matches((*view->driver_entities)[index])) index++;
+		}
+	public:
+		Iterator(View* view, size_t index) : view(view), index(index) { skip_unmatched(); }
+
+		std::tuple<Entity, Components&...> operator*() {
+			Entity e = (*view->driver_entities)[index];
+			return std::tuple<Entity, Components&...>(e, view->fetch(std::get<ComponentContainer<Components>*>(view->containers), e, index)...);
+		}
+		Iterator& operator++() { index++; skip_unmatched(); return *this; }
+		friend bool operator==(const Iterator& lhs, const Iterator& rhs) { return lhs.index == rhs.index; }
+		friend bool operator!=(const Iterator& lhs, const Iterator& rhs) { return lhs.index != rhs.index; }
+	};
+
+	Iterator begin() { return Iterator(this, 0); }
+	Iterator end() { return Iterator(this, driver_entities->size()); }
+
+	// Calls func(entity, components&...) for each match
+	template <typename Func>
+	void each(Func func) {
+		for (size_t index = 0; index < driver_entities->size(); index++) {
+			Entity e = (*driver_entities)[index];
+			if (matches(e)) func(e, fetch(std::get<ComponentContainer<Components>*>(containers), e, index)...);
+		}
+	}
+};
\ No newline at end of file
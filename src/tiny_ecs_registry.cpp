@@ -1,3 +1,18 @@
 #include "tiny_ecs_registry.hpp"
 
-ECSRegistry registry;
\ No newline at end of file
+ECSRegistry registry;
+
+void CommandBuffer::flush()
+{
+	// Commands may record more commands (e.g. a deferred create* that spawns children), so run until nothing is left
+	while (!pending.empty()) {
+		std::vector<std::function<void()>> running;
+		running.swap(pending);
+		for (std::function<void()>& command : running)
+			command();
+	}
+	std::vector<Entity> destroying;
+	destroying.swap(to_destroy);
+	for (Entity e : destroying)
+		registry.remove_all_components_of(e); // Entities destroyed twice are already released, so this does nothing
+}
\ No newline at end of file
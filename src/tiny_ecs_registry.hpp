@@ -1,17 +1,65 @@
 #pragma once
 #include <vector>
+#include <unordered_map>
+#include <typeindex>
+#include <functional>
 
 #include "tiny_ecs.hpp"
 #include "components.hpp"
 
+// Records entity creation/destruction and component inserts/removals made while a system is iterating a container, and
+// applies them all at once in flush(). The main loop flushes once per frame after collisions are handled.
+//     registry.commands.destroy(particle_entity);
+//     registry.commands.insert(registry.tempEffects, entity, { TEMP_EFFECT_TYPE::FADE_OUT, 150.f });
+//     registry.commands.defer([=]() { createPoofEffect(position, direction, colour); });
+class CommandBuffer
+{
+	std::vector<std::function<void()>> pending;
+	std::vector<Entity> to_destroy;
+public:
+	// Any call (usually a create* function) to run at the next flush
+	void defer(std::function<void()> command) {
+		pending.push_back(std::move(command));
+	}
+
+	template <typename Component>
+	void insert(ComponentContainer<Component>& container, Entity e, Component c) {
+		pending.push_back([&container, e, c]() { container.insert(e, c); });
+	}
+
+	template <typename Component>
+	void remove(ComponentContainer<Component>& container, Entity e) {
+		pending.push_back([&container, e]() { container.remove(e); });
+	}
+
+	// Removes all components of the entity and releases it, after all other commands of the flush have run
+	void destroy(Entity e) {
+		to_destroy.push_back(e);
+	}
+
+	bool empty() const { return pending.empty() && to_destroy.empty(); }
+
+	void flush();
+};
+
 class ECSRegistry
 {
 	// Callbacks to remove a particular or all entities in the system
 	std::vector<ContainerInterface*> registry_list;
+	// Lookup from component type to its container, used by view<>()
+	std::unordered_map<std::type_index, ContainerInterface*> map_type_container;
+	// Indexed by Entity::index(), bit i is set if the entity has a component in registry_list[i]
+	std::vector<Signature> signatures;
 
 public:
+	// Deferred changes, see CommandBuffer
+	CommandBuffer commands;
+
 	// Manually created list of all components this game has
 	ComponentContainer<Motion> motions;
+	ComponentContainer<MotionLinks> motionLinks;
+	ComponentContainer<Awake> awakeMotions;
+	ComponentContainer<Unindexed> unindexedMotions;
 	ComponentContainer<RenderRequest> renderRequests;
 	ComponentContainer<RoomExit> exits;
 	ComponentContainer<Room> rooms;
@@ -60,6 +108,9 @@ public:
 	ECSRegistry()
 	{
 		registry_list.push_back(&motions);
+		registry_list.push_back(&motionLinks);
+		registry_list.push_back(&awakeMotions);
+		registry_list.push_back(&unindexedMotions);
 		registry_list.push_back(&renderRequests);
 		registry_list.push_back(&exits);
 		registry_list.push_back(&rooms);
@@ -103,24 +154,52 @@ public:
 		registry_list.push_back(&particles);
 		registry_list.push_back(&waters);
 
+		for (ContainerInterface* reg : registry_list)
+			map_type_container[typeid(*reg)] = reg;
+
+		assert(registry_list.size() <= sizeof(Signature) * 8 && "Too many component types for a Signature");
+		for (unsigned int i = 0; i < registry_list.size(); i++) {
+			registry_list[i]->signature_bit = (Signature)1 << i;
+			registry_list[i]->signatures = &signatures;
+		}
+	}
+
+	// Returns the container holding components of type 'Component'
+	template <typename Component>
+	ComponentContainer<Component>& container() {
+		assert(map_type_container.count(typeid(ComponentContainer<Component>)) > 0 && "Component type not in registry");
+		return *static_cast<ComponentContainer<Component>*>(map_type_container[typeid(ComponentContainer<Component>)]);
+	}
+
+	// Iterate over all entities having all of the given components, see View in tiny_ecs.hpp
+	template <typename... Components>
+	View<Components...> view() {
+		return View<Components...>(container<Components>()...);
 	}
 
 	void clear_all_components() {
-		for (ContainerInterface* reg : registry_list)
-			reg->clear();
+		clear_all_components_except({});
 	}
 
 	void clear_all_non_essential_components() {
-		std::vector<ContainerInterface* > essentials = {
-			&screenStates,			
-		};
+		clear_all_components_except({
+			&screenStates,
+		});
+	}
+
+	// Clears every container but the kept ones. Entities left without a component are deleted like in
+	// remove_all_components_of(), so a room restart recycles their indices instead of taking new ones
+	void clear_all_components_except(const std::vector<ContainerInterface*>& kept) {
+		std::vector<Entity> cleared_entities;
 		for (ContainerInterface* reg : registry_list) {
-			if (std::none_of(essentials.begin(), essentials.end(), 
-				[reg](ContainerInterface* item){ return reg == item; })
-			) {
+			if (std::find(kept.begin(), kept.end(), reg) == kept.end()) {
+				reg->append_entities(cleared_entities);
 				reg->clear();
 			}
 		}
+		for (Entity e : cleared_entities) {
+			if (signature_of(e) == 0) Entity::release(e); // Released once, the copies from other containers are stale by then
+		}
 	}
 
 	void list_all_components() {
@@ -132,14 +211,48 @@ public:
 
 	void list_all_components_of(Entity e) {
 		printf("Debug info on components of entity %u:\n", (unsigned int)e);
-		for (ContainerInterface* reg : registry_list)
-			if (reg->has(e))
-				printf("type %s\n", typeid(*reg).name());
+		Signature bits = signature_of(e);
+		for (unsigned int i = 0; bits != 0; i++, bits >>= 1)
+			if (bits & 1)
+				printf("type %s\n", typeid(*registry_list[i]).name());
+	}
+
+	// The set of component types the entity currently has, 0 for deleted entities
+	Signature signature_of(Entity e) {
+		if (!e.is_alive() || e.index() >= signatures.size()) return 0;
+		return signatures[e.index()];
 	}
 
+	// Signature with the bits of all the given component types, for use with matches()
+	template <typename... Components>
+	Signature signature_for() {
+		return (container<Components>().signature_bit | ...);
+	}
+
+	// True if the entity has (at least) every component type in the given signature
+	bool matches(Entity e, Signature required) {
+		return (signature_of(e) & required) == required;
+	}
+
+	// True if the entity has all of the given components:  registry.has_all<Motion, Enemy>(entity)
+	template <typename... Components>
+	bool has_all(Entity e) {
+		return matches(e, signature_for<Components...>());
+	}
+
+	// Deletes the entity: its index is recycled, so any remaining handles to it become stale (is_alive() == false)
+	// Only the containers in the entity's signature are touched
 	void remove_all_components_of(Entity e) {
-		for (ContainerInterface* reg : registry_list)
-			reg->remove(e);
+		if (!e.is_alive()) return;
+		if (e.index() < signatures.size()) {
+			Signature bits = signatures[e.index()];
+			for (unsigned int i = 0; bits != 0; i++, bits >>= 1) {
+				if (bits & 1)
+					registry_list[i]->remove(e);
+			}
+			assert(signatures[e.index()] == 0);
+		}
+		Entity::release(e);
 	}
 };
 
@@ -1,7 +1,6 @@
 #include "world_init.hpp"
 #include "tiny_ecs_registry.hpp"
 #include "../ext/rapidjson/document.h"
-#include "../ext/pathfinder/AStar.hpp"
 #include <glm/gtx/rotate_vector.hpp>
 #include <glm/gtc/random.hpp>
 #include "world_system.hpp"
@@ -120,8 +119,12 @@ std::vector<std::vector<int>> type_weights_list = {
 Motion& createMotion(Entity e, uint32 type, vec2 pos, vec2 scale, float max_speed) {
 	Motion& motion = registry.motions.emplace(e);
 	motion.position = pos;
+	motion.last_position = pos; // Otherwise it's drawn flying in from the origin until its first physics step
 	motion.max_speed = max_speed;
 	motion.moving = (max_speed == 0.f) ? false : true;
+	if (motion.moving) {
+		registry.awakeMotions.emplace(e);
+	}
 	motion.scale = scale;
 	motion.sprite_offset = (type & (BEING_MASK | OBSTACLE_MASK | PROP_MASK)) ? vec2(0, -scale.y / 2.f) : vec2(0, 0);
 	motion.radius = abs(scale.x) / 4.f;
@@ -132,19 +135,51 @@ Motion& createMotion(Entity e, uint32 type, vec2 pos, vec2 scale, float max_spee
 		SpatialGrid& spatial_grid = SpatialGrid::getInstance();
 		motion.cell_coords = spatial_grid.get_grid_cell_coords(motion.position);
 		if (!spatial_grid.are_cell_coords_out_of_bounds(motion.cell_coords)) {
-			motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, e);
+			if (type == OBSTACLE_MASK && max_speed == 0.f && spatial_grid.is_large(motion.radius)) {
+				// Callers may only shrink the radius after this, so the bbox stays big enough
+				vec2 radius_change = { motion.radius, motion.radius };
+				spatial_grid.add_large_entity(e, get_bbox(motion.position, 2.f * radius_change));
+				motion.cell_index = SpatialGrid::LARGE_ENTITY_INDEX;
+			} else {
+				motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, e);
+			}
 			if (type == OBSTACLE_MASK) {
 				Room& room = registry.rooms.components[0];
-				room.generator.addCollision({ motion.cell_coords.x, motion.cell_coords.y });
+				room.pathfinder.add_collision(motion.cell_coords);
+				room.line_of_sight.mark_occluders_changed();
 			}
 		} else { // Testing not even putting them in the grid at all:
 			//motion.cell_index = spatial_grid.add_entity_to_cell({0,0}, e); // Hacky fix for when spawned entities are outside of grid
 			//motion.cell_coords = {0,0};
 		}
 	}
+	if (motion.cell_index == INT_MAX && type != POLYGON_MASK) { // Polygons are indexed by createComplexPolygon()
+		registry.unindexedMotions.emplace(e);
+	}
 	return motion;
 }
 
+void attachMotionChild(Entity parent, Entity child) {
+	if (!registry.motionLinks.has(parent)) {
+		registry.motionLinks.emplace(parent);
+	}
+	registry.motionLinks.get(parent).add_child(child);
+	if (!registry.motionLinks.has(child)) {
+		registry.motionLinks.emplace(child);
+	}
+	registry.motionLinks.get(child).parent = parent; // Not kept as a reference, emplace above may reallocate
+}
+
+void detachMotionChild(Entity child) {
+	MotionLinks* child_links = registry.motionLinks.find(child);
+	if (!child_links || !child_links->parent) { return; }
+	Entity parent = *child_links->parent;
+	child_links->parent = std::nullopt;
+	if (MotionLinks* parent_links = registry.motionLinks.find(parent)) {
+		parent_links->remove_child(child);
+	}
+}
+
 // TODO: Finish this for better optimization
 RenderRequest& createRenderRequest(Entity e, Motion& motion, DIFFUSE_ID diffuse_id, NORMAL_ID normal_id, bool casts_shadow) {
 	RenderRequest& render_request = registry.renderRequests.insert(e, { diffuse_id, normal_id });
@@ -410,7 +445,7 @@ Entity createChestOpening(vec2 pos) {
 Entity createBreadcrumbEatingEffect(vec2 position) {
 	auto entity = Entity();
 	Motion& motion = createMotion(entity, UNCOLLIDABLE_MASK, position, {150.f, 150.f}, 0.f);
-	assert(motion.parent == std::nullopt);
+	assert(!registry.motionLinks.has(entity));
 
 	// setup animation
 	float anim_length = 500.f;
@@ -434,8 +469,7 @@ Entity createPush(vec2 position, Entity player) {
 
 	auto entity = Entity();
 	Motion& motion = createMotion(entity, MELEE_ATTACK_MASK, position, Upgrades::get_gretel_m2_area(), 0.f);
-	registry.motions.get(player).add_child(entity);
-	motion.parent = player;
+	attachMotionChild(player, entity);
 	motion.sprite_normal = {0,0,1};
 	motion.sprite_offset.y = registry.motions.get(player).sprite_offset.y;
 
@@ -459,8 +493,7 @@ Entity createPush(vec2 position, Entity player) {
 Entity createWitchPush(vec2 position, Entity owner) {
 	auto entity = Entity();
 	Motion& motion = createMotion(entity, MELEE_ATTACK_MASK, position, vec2(500.f), 0.f);
-	registry.motions.get(owner).add_child(entity);
-	motion.parent = owner;
+	attachMotionChild(owner, entity);
 	motion.sprite_normal = { 0,0,1 };
 	motion.sprite_offset.y = registry.motions.get(owner).sprite_offset.y;
 
@@ -497,8 +530,7 @@ Entity createAttack(vec2 position, vec2 orientation, Entity player) {
 	//motion.scale = vec2(40.f);
 
 	// Make child of player motion. Will cause attack sprite to follow player
-	registry.motions.get(player).add_child(entity);
-	motion.parent = player;
+	attachMotionChild(player, entity);
 	motion.sprite_normal = {0,0,1}; // You can change it back, but I think it's better for it to be horizontal with the ground
 									// Or maybe we can make it 45deg
 	motion.sprite_offset = registry.motions.get(player).sprite_offset;
@@ -537,8 +569,7 @@ Entity createHealingEffect(vec2 position, Entity parent) {
 	motion.sprite_offset.y += -100.f;
 
 	// Make child of player motion. Will cause attack sprite to follow player
-	registry.motions.get(parent).add_child(entity);
-	motion.parent = parent;
+	attachMotionChild(parent, entity);
 
 	// Setup animations
 	float animation_length = 1000.f;
@@ -566,8 +597,7 @@ Entity createSparkleEffect(vec2 position, Entity parent, vec3 multiply_color) {
 	motion.sprite_offset.y += -30.f;
 
 	// Make child of player motion. Will cause attack sprite to follow player
-	registry.motions.get(parent).add_child(entity);
-	motion.parent = parent;
+	attachMotionChild(parent, entity);
 
 	// Setup animations
 	float animation_length = 1000.f;
@@ -1412,8 +1442,7 @@ Entity createHellfireWarning(vec2 position, Entity parent)
 	Motion& motion = createMotion(entity, UNCOLLIDABLE_MASK, position, { 80.f, 80.f }, 0.f);
 
 	// Make child of parent (which is the witch in this case). Will cause attack sprite to follow parent
-	registry.motions.get(parent).add_child(entity);
-	motion.parent = parent;
+	attachMotionChild(parent, entity);
 
 	// Setup animations
 	float animation_length = 2000.f;
@@ -1579,7 +1608,7 @@ Entity createWorldLighting() // Could be moved into createRoom, and specified in
 Entity createCamera()
 {
 	auto entity = Entity();
-	registry.cameras.insert(entity, { M_PI / 4.f });
+	registry.cameras.emplace(entity);
 	return entity;
 }
 
@@ -1623,32 +1652,40 @@ ComplexPolygon& createComplexPolygon(Entity entity, std::vector<Edge>& edges, ve
 	}
 	ComplexPolygon& polygon = registry.polygons.emplace(entity, world_edges, position, is_only_edge, is_platform);
 	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
-	float radius = (is_platform) ? 0.f : WorldSystem::TILE_SIZE;
-	std::vector<Cell> cells = spatial_grid.raster_polygon(polygon, radius, is_only_edge);
-	assert(registry.motions.get(entity).type_mask == POLYGON_MASK);
+	Motion& motion = registry.motions.get(entity);
+	assert(motion.type_mask == POLYGON_MASK);
+	if (is_only_edge) { // Room bounds etc. would be in the whole coarse level, so rasterize just around their edges
+		for (Cell* cell : spatial_grid.raster_polygon(polygon, WorldSystem::TILE_SIZE, true)) {
+			spatial_grid.add_entity_to_cell(cell->coords, entity);
+		}
+		return polygon;
+	}
+	BBox bbox = get_bbox(polygon);
+	spatial_grid.add_large_entity(entity, bbox); // Other polygons live in the coarse level, no rasterizing needed
+	motion.cell_index = SpatialGrid::LARGE_ENTITY_INDEX;
+
+	// Update the pathfinding grid for the cells whose centers are within the polygon
 	Room& room = registry.rooms.components[0];
-	for (uint i = 0; i < cells.size(); i++) {
-		Cell& cell = cells[i];
-		bool is_platform_here = false;
-		if (!is_platform) {
-			for (int j = 0; j < cell.num_entities; j++) {
-				Motion& motion_other = registry.motions.get(cell.entities[j]);
-				if (motion_other.type_mask == POLYGON_MASK) {
-					ComplexPolygon& polygon = registry.polygons.get(cell.entities[j]);
-					if (polygon.is_platform) { is_platform_here = true;  }
-				}
+	room.line_of_sight.mark_occluders_changed();
+	ivec2 min_XY = glm::max(spatial_grid.get_grid_cell_coords({ bbox.x_low, bbox.y_low }), ivec2(0));
+	ivec2 max_XY = glm::min(spatial_grid.get_grid_cell_coords({ bbox.x_high, bbox.y_high }), spatial_grid.grid_size - 1);
+	for (int X = min_XY.x; X <= max_XY.x; X++) {
+		for (int Y = min_XY.y; Y <= max_XY.y; Y++) {
+			vec2 cell_world_position = vec2(X + 0.5f, Y + 0.5f) * WorldSystem::TILE_SIZE;
+			if (!is_point_within_polygon(polygon, cell_world_position)) { continue; }
+			if (is_platform) {
+				room.pathfinder.remove_collision({ X, Y });
+				continue;
 			}
-		}
-		spatial_grid.add_entity_to_cell(cell.coords, entity);
-		if (is_platform_here) { continue; }
-		if (!is_only_edge) {
-			vec2 cell_world_position = vec2(cell.coords.x + 0.5f, cell.coords.y + 0.5f) * WorldSystem::TILE_SIZE;
-			if (is_point_within_polygon(polygon, cell_world_position)) { // Must check again so we don't include cells outside polygon
-				if (is_platform) {
-					room.generator.removeCollision({ cell.coords.x, cell.coords.y });
-				} else {
-					room.generator.addCollision({ cell.coords.x, cell.coords.y });
-				}
+			bool is_platform_here = false; // Cells covered by a platform stay walkable
+			spatial_grid.for_each_in_rect({ X, Y }, { X, Y }, [&](Entity entity_other) {
+				if (entity_other == entity || registry.motions.get(entity_other).type_mask != POLYGON_MASK) { return true; }
+				ComplexPolygon& polygon_other = registry.polygons.get(entity_other);
+				is_platform_here = polygon_other.is_platform && is_point_within_polygon(polygon_other, cell_world_position);
+				return !is_platform_here;
+			});
+			if (!is_platform_here) {
+				room.pathfinder.add_collision({ X, Y });
 			}
 		}
 	}
@@ -1682,8 +1719,8 @@ Entity createPlatform(RenderSystem* renderer, vec2 position, vec2 scale, float a
 	registry.meshPtrs.emplace(entity, &mesh);
 
 	ComplexPolygon& polygon = createComplexPolygon(entity, mesh.edges, motion, false, true);
-	polygon.world_edges[0].is_collidable = false;
-	polygon.world_edges[3].is_collidable = false;
+	polygon.set_edge_collidable(0, false);
+	polygon.set_edge_collidable(3, false);
 
 	return entity;
 }
@@ -2019,6 +2056,9 @@ Entity createRoom(RenderSystem* renderer, float tile_size, std::string json_path
 	// Set grid size
 	room.grid_size.x = (int)dom["grid_size"]["num_cols"].GetInt();	// Grid width
 	room.grid_size.y = (int)dom["grid_size"]["num_rows"].GetInt();	// Grid height
+	SpatialGrid::getInstance().resize(room.grid_size);
+	room.pathfinder.resize(room.grid_size);
+	room.line_of_sight.resize(room.grid_size);
 	
 	int room_type = (dom.HasMember("room_type")) ? dom["room_type"].GetInt() : 1;
 	if (room_type == 1) {   // DIFFUSE_ID::GRASS, NORMAL_ID::GRASS
@@ -2027,11 +2067,6 @@ Entity createRoom(RenderSystem* renderer, float tile_size, std::string json_path
 		createRoomGround(room, DIFFUSE_ID::MENU, NORMAL_ID::FLAT, 3.f);
 	}
 
-	// Initializes room's path finder generator
-	room.generator.setWorldSize({ (int) room.grid_size.x,(int) room.grid_size.y });
-	room.generator.setHeuristic(AStar::Heuristic::euclidean);
-	//room.generator.setDiagonalMovement(true);
-	
 	// Set player spawn
 	room.player_spawn.x = dom["player_spawn"]["x"].GetFloat() + 0.5f;
 	room.player_spawn.y = dom["player_spawn"]["y"].GetFloat() + 0.5f;
@@ -2157,10 +2192,10 @@ Entity createIgnoreGroundPiece(RenderSystem* renderer, vec2 position, vec2 scale
 	registry.meshPtrs.emplace(entity, &mesh);
 
 	ComplexPolygon& polygon = createComplexPolygon(entity, mesh.edges, motion, false, false);
-	polygon.world_edges[0].is_collidable = false;
-	polygon.world_edges[1].is_collidable = false;
-	polygon.world_edges[2].is_collidable = false;
-	polygon.world_edges[3].is_collidable = false;
+	polygon.set_edge_collidable(0, false);
+	polygon.set_edge_collidable(1, false);
+	polygon.set_edge_collidable(2, false);
+	polygon.set_edge_collidable(3, false);
 
 	return entity;
 }
@@ -63,6 +63,9 @@ const uint32 UNCOLLIDABLE_MASK	= 0,
 
 
 Motion& createMotion(Entity e, uint32 type, vec2 pos, vec2 scale, float max_speed);
+// Makes child's motion follow parent's motion (see MotionLinks)
+void attachMotionChild(Entity parent, Entity child);
+void detachMotionChild(Entity child);
 
 BezierCurve& insertBezierCurve(Entity entity, vec2 position, vec2 direction);
 // the player
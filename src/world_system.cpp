@@ -332,6 +332,17 @@ void WorldSystem::update_window() {
 	// Updating window title with points
 	std::stringstream title_ss;
 	title_ss << "Shinies: " << num_shinies;
+	if (debugging.in_debug_mode) {
+		title_ss << "   |   Awake motions: " << registry.awakeMotions.size() << " / " << registry.motions.size();
+	}
+	if (registry.rooms.size() > 0) { // Lines the AI had tested this frame, the rest reused an answer
+		LineOfSight& line_of_sight = registry.rooms.components[0].line_of_sight;
+		if (debugging.in_debug_mode) {
+			title_ss << "   |   Lines of sight tested: " << line_of_sight.num_lines_tested << " / " << line_of_sight.num_queries
+				<< " (" << line_of_sight.num_lines_batched << " batched)";
+		}
+		line_of_sight.num_queries = 0; line_of_sight.num_lines_tested = 0; line_of_sight.num_lines_batched = 0;
+	}
 	glfwSetWindowTitle(window, title_ss.str().c_str());
 }
 
@@ -339,17 +350,33 @@ void WorldSystem::update_window() {
 void WorldSystem::remove_entity(Entity entity) { // Maybe add a death effect enum?
 	if (registry.motions.has(entity)) {
 		Motion& motion = registry.motions.get(entity);
-		if (motion.cell_index != INT_MAX) {
+		if (motion.cell_index == SpatialGrid::LARGE_ENTITY_INDEX) {
+			SpatialGrid::getInstance().remove_large_entity(entity);
+			motion.cell_index = INT_MAX;
+		} else if (motion.cell_index == SpatialGrid::BAKED_ENTITY_INDEX) {
+			SpatialGrid::getInstance().static_colliders.remove(entity);
+			motion.cell_index = INT_MAX;
+		} else if (motion.cell_index != INT_MAX) {
 			// Testing without: motion.type_mask != UNCOLLIDABLE_MASK && motion.type_mask != MELEE_ATTACK_MASK && motion.type_mask != POLYGON_MASK && 
 			SpatialGrid::getInstance().remove_entity_from_cell(motion.cell_coords, motion.cell_index, entity);
 			motion.cell_index = INT_MAX;
 		}
+		if (motion.cell_index == INT_MAX && !registry.unindexedMotions.has(entity)) { // Still drawn while its death plays out
+			registry.unindexedMotions.emplace(entity);
+		}
+		if (motion.type_mask & (OBSTACLE_MASK | POLYGON_MASK)) { // AI lines of sight may be clear now
+			registry.rooms.components[0].line_of_sight.mark_occluders_changed();
+		}
 		motion.type_mask = UNCOLLIDABLE_MASK;
 		motion.max_speed = 0.f;
 		if (debugging.in_debug_mode) { remove_collider_debug(entity); }
 
-		for (int i = 0; i < motion.children.size(); i++) {
-			remove_entity(motion.children[i]);
+		if (registry.motionLinks.has(entity)) {
+			// Copy since removing children may reallocate the MotionLinks container
+			auto children = registry.motionLinks.get(entity).children;
+			for (int i = 0; i < children.size(); i++) {
+				remove_entity(children[i]);
+			}
 		}
 	}
 	if (registry.enemies.has(entity)) { // First call to this function removes Enemy components from enemies and add to tempEffects
@@ -540,9 +567,7 @@ bool WorldSystem::step(float elapsed_ms_since_last_update) {
 			// Remove from parent's child list before deleting // TODO: Maybe can move this into remove_entity?
 			if (registry.motions.has(entity)) {
 				Motion& motion = registry.motions.get(entity);
-				if (motion.parent && registry.motions.has(*motion.parent)) {
-					registry.motions.get(*motion.parent).remove_child(entity);
-				}
+				detachMotionChild(entity);
 
 				// Spawn loot when chest effect is over
 				if (effect.type == TEMP_EFFECT_TYPE::CHEST_OPENING) {
@@ -682,6 +707,7 @@ void WorldSystem::restart_game() {
 // Reset the level to its initial state
 void WorldSystem::restart_level() {
 	printf("Restarting Level\n");
+	auto load_start = std::chrono::high_resolution_clock::now();
 
 	// Reset the game speed
 	current_speed = 1.f;
@@ -776,6 +802,7 @@ void WorldSystem::restart_level() {
 		remove_entity(exit_entity);
 		Entity new_exit = createExit(position, next_room_ind);
 	}
+	SpatialGrid::getInstance().bake_static_colliders(); // Everything static in the room exists by now
 
 	input_tracker = { false, false, false, false, input_tracker.torchlight };
 
@@ -830,6 +857,8 @@ void WorldSystem::restart_level() {
 
 		registry.tempEffects.insert(helper_text, {TEMP_EFFECT_TYPE::TEXT, 10*1000});
 	}
+	float load_elapsed = (float)(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - load_start)).count() / 1000;
+	printf("Room loaded in %fms\n", load_elapsed);
 }
 
 // Recreates all player components
@@ -983,6 +1012,7 @@ void apply_damage_effect(Entity enemy, Motion& enemy_motion, vec2 knockback_dire
 	// Apply knockback
 	if (knockback_magnitude != 0.f) {
 		enemy_motion.velocity = knockback_direction * knockback_magnitude;
+		wake_motion(enemy);
 	}
 	// Apply damage color effect
 	registry.enemies.get(enemy).damaged_color_timer = ENEMY_DAMAGED_EFFECT_MS;
@@ -1052,10 +1082,10 @@ void WorldSystem::damage_player(int damage) {
 	}
 }
 
-Entity to_be_deleted[200] = {}; // 200 as a generous upper limit
 void WorldSystem::handle_collisions()
 {
-	int num_deleted = 0;
+	// Delete entities after the loop to avoid bugs. The main loop flushes the CommandBuffer right after this
+	auto remove_after_loop = [this](Entity e) { registry.commands.defer([this, e]() { remove_entity(e); }); };
 	auto& collisions_registry = registry.collisions;
 	for (int i = 0; i < collisions_registry.components.size(); i++) {
 		Entity entity = collisions_registry.entities[i];
@@ -1086,7 +1116,7 @@ void WorldSystem::handle_collisions()
 				// Delete chest and replace it with the chest opening effect
 				createChestOpening(motion_other.position);
 				Mix_PlayChannel(-1, chest_open, 0);
-				to_be_deleted[num_deleted++] = entity_other;
+				remove_after_loop(entity_other);
 			}
 			break;
 		case (BEING_MASK | PICKUPABLE_MASK):
@@ -1126,7 +1156,7 @@ void WorldSystem::handle_collisions()
 				default:
 					assert(false);
 				}
-				to_be_deleted[num_deleted++] = entity_other;
+				remove_after_loop(entity_other);
 			}
 			break;
 		case (BEING_MASK | PROJECTILE_MASK):
@@ -1177,7 +1207,7 @@ void WorldSystem::handle_collisions()
 					}
 
 					if (projectile.hits_left <= 0) {
-						to_be_deleted[num_deleted++] = entity_other;
+						remove_after_loop(entity_other);
 					}
 				}
 				else if (registry.enemies.has(entity) && registry.enemyAttractors.has(entity_other)) {
@@ -1186,7 +1216,7 @@ void WorldSystem::handle_collisions()
 						bear_health.current_hp = bear_health.max_hp; // restore to full health?
 						createHealingEffect(motion.position, entity);
 						Mix_PlayChannel(-1, chicken_eat_sound, 0); // maybe a bear chew sound?
-						to_be_deleted[num_deleted++] = entity_other;
+						remove_after_loop(entity_other);
 					}
 				}
 			}
@@ -1277,7 +1307,7 @@ void WorldSystem::handle_collisions()
 					colour = vec3(1.f);
 				}
 				createPoofEffect(position, direction, colour);
-				to_be_deleted[num_deleted++] = entity_other;
+				remove_after_loop(entity_other);
 			}
 		}
 		break;
@@ -1287,7 +1317,7 @@ void WorldSystem::handle_collisions()
 				// Player attack removes enemy projectiles it collides with
 				Projectile& projectile = registry.projectiles.get(entity);
 				if (registry.enemies.has(projectile.owner)) {
-					to_be_deleted[num_deleted++] = entity;
+					remove_after_loop(entity);
 				}
 			}
 			break;
@@ -1304,9 +1334,6 @@ void WorldSystem::handle_collisions()
 		}
 	}
 
-	for (uint i = 0; i < num_deleted; i++) { // delete all entities after loop to avoid bug
-		remove_entity(to_be_deleted[i]);
-	}
 	registry.collisions.clear();
 }
 
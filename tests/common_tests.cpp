@@ -0,0 +1,60 @@
+// internal
+#include "tests.hpp"
+#include "components.hpp"
+
+// The motion children and animation tracks of 10000 spawns, handled like world_init and the physics step do: fill within
+// capacity, copy, remove by swapping with the last and clear. InlineVector must not allocate once, and must hold the same
+// entities as the std::vector it replaced, which does the same work
+int test_inline_vector()
+{
+	const uint NUM_SPAWNS = 10000;
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	std::vector<Entity> handles(MotionLinks::MAX_CHILDREN);
+	// Made before counting, like the animation a particle generator keeps for its particles
+	SpriteSheetAnimation animation(16, { { 0, 1, 2, 3 }, { 4, 5, 6, 7, 8, 9, 10, 11 }, { 12, 13, 14, 15 } },
+		{ 100.f, 50.f, 100.f });
+
+	uint first_num_allocations = num_allocations;
+	auto start = Clock::now();
+	uint num_entities = 0;
+	for (uint spawn = 0; spawn < NUM_SPAWNS; spawn++) {
+		InlineVector<Entity, MotionLinks::MAX_CHILDREN> children;
+		for (Entity handle : handles) { children.push_back(handle); }
+		InlineVector<Entity, MotionLinks::MAX_CHILDREN> copy = children;
+		copy.erase_swap(spawn % copy.size());
+		copy.pop_back();
+		children = copy;
+		SpriteSheetAnimation particle_animation = animation;
+		particle_animation.set_track(spawn % 3);
+		num_entities += (uint)children.size() + (uint)particle_animation.tracks[particle_animation.track_index].size();
+		children.clear();
+	}
+	optimized_us += elapsed_us(start);
+	uint num_inline_allocations = num_allocations - first_num_allocations;
+
+	first_num_allocations = num_allocations;
+	start = Clock::now();
+	uint num_entities_reference = 0;
+	std::vector<std::vector<int>> tracks = { { 0, 1, 2, 3 }, { 4, 5, 6, 7, 8, 9, 10, 11 }, { 12, 13, 14, 15 } };
+	for (uint spawn = 0; spawn < NUM_SPAWNS; spawn++) {
+		std::vector<Entity> children;
+		for (Entity handle : handles) { children.push_back(handle); }
+		std::vector<Entity> copy = children;
+		copy[spawn % copy.size()] = copy.back();
+		copy.pop_back();
+		copy.pop_back();
+		children = copy;
+		std::vector<std::vector<int>> particle_tracks = tracks;
+		num_entities_reference += (uint)children.size() + (uint)particle_tracks[spawn % 3].size();
+		children.clear();
+	}
+	reference_us += elapsed_us(start);
+	uint num_reference_allocations = num_allocations - first_num_allocations;
+
+	num_mismatches += num_inline_allocations + (num_entities != num_entities_reference);
+	int num_failed = check("Inline vector", num_mismatches, optimized_us, reference_us);
+	printf("%-28s allocations: %u, std::vector: %u\n", "", num_inline_allocations, num_reference_allocations);
+	for (Entity handle : handles) { Entity::release(handle); }
+	return num_failed;
+}
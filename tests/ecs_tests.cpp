@@ -0,0 +1,217 @@
+// internal
+#include "tests.hpp"
+#include "tiny_ecs_registry.hpp"
+
+#include <algorithm>
+#include <unordered_map>
+
+// ComponentContainer as it was before the sparse set: entity id -> component index through a hash map
+template <typename Component>
+struct MapContainer
+{
+	std::unordered_map<unsigned int, unsigned int> map_entity_componentID;
+	std::vector<Component> components;
+	std::vector<Entity> entities;
+
+	void insert(Entity e, Component c) {
+		map_entity_componentID[e] = (unsigned int)components.size();
+		components.push_back(std::move(c));
+		entities.push_back(e);
+	}
+	bool has(Entity e) {
+		return map_entity_componentID.count(e) > 0;
+	}
+	Component& get(Entity e) {
+		return components[map_entity_componentID[e]];
+	}
+	void remove(Entity e) {
+		if (!has(e)) return;
+		unsigned int cID = map_entity_componentID[e];
+		components[cID] = std::move(components.back());
+		entities[cID] = entities.back();
+		map_entity_componentID[entities.back()] = cID;
+		map_entity_componentID.erase(e);
+		components.pop_back();
+		entities.pop_back();
+	}
+};
+
+// The sparse set index against the hash map it replaced, for 10k to 100k motions: insert all, then for 10 frames look
+// them all up in random order (each twice, like a system reading then writing) and ask for entities that have none, then
+// remove half. Both must give the same components throughout
+int test_component_lookup()
+{
+	int num_failed = 0;
+	for (uint num_entities : { 10000u, 30000u, 100000u }) {
+		int num_mismatches = 0;
+		double optimized_us = 0, reference_us = 0;
+		ComponentContainer<Motion> container;
+		MapContainer<Motion> reference;
+		std::vector<Entity> entities(num_entities);
+		std::vector<Entity> others(num_entities / 4); // Never given a motion
+		std::vector<Entity> order = entities;
+		std::shuffle(order.begin(), order.end(), rng);
+
+		auto start = Clock::now();
+		for (Entity entity : entities) { container.emplace(entity).position = { (float)entity.index(), 0.f }; }
+		optimized_us += elapsed_us(start);
+		start = Clock::now();
+		for (Entity entity : entities) {
+			Motion motion;
+			motion.position = { (float)entity.index(), 0.f };
+			reference.insert(entity, motion);
+		}
+		reference_us += elapsed_us(start);
+
+		float sum = 0.f, sum_reference = 0.f;
+		start = Clock::now();
+		for (int frame = 0; frame < 10; frame++) {
+			for (Entity entity : order) { container.get(entity).velocity.x += container.get(entity).position.x; }
+			for (Entity entity : others) { sum += container.has(entity); }
+		}
+		optimized_us += elapsed_us(start);
+		start = Clock::now();
+		for (int frame = 0; frame < 10; frame++) {
+			for (Entity entity : order) { reference.get(entity).velocity.x += reference.get(entity).position.x; }
+			for (Entity entity : others) { sum_reference += reference.has(entity); }
+		}
+		reference_us += elapsed_us(start);
+		num_mismatches += sum != 0.f || sum_reference != 0.f;
+
+		start = Clock::now();
+		for (uint i = 0; i < num_entities / 2; i++) { container.remove(order[i]); }
+		optimized_us += elapsed_us(start);
+		start = Clock::now();
+		for (uint i = 0; i < num_entities / 2; i++) { reference.remove(order[i]); }
+		reference_us += elapsed_us(start);
+
+		num_mismatches += container.size() != reference.components.size();
+		for (uint i = 0; i < num_entities; i++) {
+			Entity entity = order[i];
+			bool is_kept = i >= num_entities / 2;
+			if (container.has(entity) != is_kept || reference.has(entity) != is_kept) {
+				num_mismatches++;
+			} else if (is_kept && container.get(entity).velocity.x != reference.get(entity).velocity.x) {
+				num_mismatches++;
+			}
+		}
+		char name[64];
+		snprintf(name, sizeof(name), "Component lookup (%uk)", num_entities / 1000);
+		num_failed += check(name, num_mismatches, optimized_us, reference_us);
+		for (Entity entity : entities) { Entity::release(entity); }
+		for (Entity entity : others) { Entity::release(entity); }
+	}
+	return num_failed;
+}
+
+// View iteration against the has()/get() loops it replaced, over 100 frames of a dense room: 20000 motions that are all
+// drawn, half of them healthy and a quarter enemies. Both must visit the same components
+int test_view_iteration()
+{
+	const uint ROOM_SIZE = 20000;
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	std::vector<Entity> room_entities;
+	for (uint i = 0; i < ROOM_SIZE; i++) {
+		Entity entity = Entity();
+		registry.motions.emplace(entity).position = { random_float(0.f, 1000.f), random_float(0.f, 1000.f) };
+		registry.renderRequests.emplace(entity);
+		if (i % 2 == 0) { registry.healthies.emplace(entity, random_float(1.f, 100.f)); }
+		if (i % 4 == 0) { registry.enemies.emplace(entity, ENEMY_TYPE::RAT); }
+		room_entities.push_back(entity);
+	}
+	float sum = 0.f, sum_reference = 0.f;
+	uint num_visited = 0, num_visited_reference = 0;
+	auto iterate = [&]() {
+		auto start = Clock::now();
+		for (auto [entity, render_request, motion] : registry.view<RenderRequest, Motion>()) {
+			sum += motion.position.x * (float)render_request.is_normal_sprite_sheet + motion.position.y;
+			num_visited++;
+		}
+		for (auto [entity, healthy, motion, enemy] : registry.view<Healthy, Motion, Enemy>()) {
+			sum += healthy.current_hp * motion.position.x;
+			num_visited++;
+		}
+		optimized_us += elapsed_us(start);
+	};
+	auto iterate_reference = [&]() {
+		auto start = Clock::now();
+		for (size_t i = 0; i < registry.renderRequests.entities.size(); i++) {
+			Entity entity = registry.renderRequests.entities[i];
+			RenderRequest& render_request = registry.renderRequests.components[i];
+			Motion& motion = registry.motions.get(entity);
+			sum_reference += motion.position.x * (float)render_request.is_normal_sprite_sheet + motion.position.y;
+			num_visited_reference++;
+		}
+		for (size_t i = 0; i < registry.healthies.entities.size(); i++) {
+			Entity entity = registry.healthies.entities[i];
+			if (!registry.motions.has(entity) || !registry.enemies.has(entity)) continue;
+			sum_reference += registry.healthies.components[i].current_hp * registry.motions.get(entity).position.x;
+			num_visited_reference++;
+		}
+		reference_us += elapsed_us(start);
+	};
+	// Same views through each()
+	double each_us = 0;
+	auto iterate_each = [&]() {
+		auto start = Clock::now();
+		registry.view<RenderRequest, Motion>().each([&](Entity entity, RenderRequest& render_request, Motion& motion) {
+			sum += motion.position.x * (float)render_request.is_normal_sprite_sheet + motion.position.y;
+			num_visited++;
+		});
+		registry.view<Healthy, Motion, Enemy>().each([&](Entity entity, Healthy& healthy, Motion& motion, Enemy& enemy) {
+			sum += healthy.current_hp * motion.position.x;
+			num_visited++;
+		});
+		each_us += elapsed_us(start);
+	};
+	for (int frame = 0; frame < 100; frame++) { // Taking turns going first, so neither always finds the room in cache
+		sum = sum_reference = 0.f;
+		num_visited = num_visited_reference = 0;
+		if (frame % 2 == 0) { iterate(); iterate_reference(); }
+		else { iterate_reference(); iterate(); }
+		num_mismatches += sum != sum_reference || num_visited != num_visited_reference;
+		sum = 0.f;
+		num_visited = 0;
+		iterate_each();
+		num_mismatches += sum != sum_reference || num_visited != num_visited_reference;
+	}
+	int num_failed = check("View iteration", num_mismatches, optimized_us, reference_us);
+	printf("%-28s each(): %.0fus\n", "", each_us);
+	registry.clear_all_components();
+	return num_failed;
+}
+
+// Restarts a room of 5000 entities 100 times like WorldSystem::restart_level() does. The cleared entities must give their
+// indices back, so the new indices handed out stay within a couple of rooms' worth, while the screen state entity survives
+int test_registry_clear()
+{
+	const uint ROOM_SIZE = 5000;
+	int num_mismatches = 0;
+	double clear_us = 0;
+	Entity screen = Entity();
+	registry.screenStates.emplace(screen);
+	registry.motions.emplace(screen);
+	uint first_num_indices = Entity::num_indices();
+	std::vector<Entity> room_entities;
+	for (int room = 0; room < 100; room++) {
+		room_entities.clear();
+		for (uint i = 0; i < ROOM_SIZE; i++) {
+			Entity entity = Entity();
+			registry.motions.emplace(entity);
+			if (i % 4 == 0) { registry.enemies.emplace(entity, ENEMY_TYPE::RAT); }
+			room_entities.push_back(entity);
+		}
+		auto start = Clock::now();
+		registry.clear_all_non_essential_components();
+		clear_us += elapsed_us(start);
+		for (Entity entity : room_entities) { num_mismatches += entity.is_alive(); }
+		num_mismatches += !screen.is_alive() || !registry.screenStates.has(screen) || registry.motions.has(screen);
+	}
+	uint num_new_indices = Entity::num_indices() - first_num_indices;
+	num_mismatches += num_new_indices > 2 * ROOM_SIZE + 1024; // Entity re-uses an index once 1024 are free
+	int num_failed = check("Registry clear", num_mismatches, clear_us, 0);
+	printf("%-28s new indices: %u for %u entities\n", "", num_new_indices, 100 * ROOM_SIZE);
+	registry.clear_all_components();
+	return num_failed;
+}
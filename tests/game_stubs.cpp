@@ -0,0 +1,14 @@
+// internal
+#include "world_system.hpp"
+#include "world_init.hpp"
+
+// physics_system.cpp links against these, but the sources they're defined in need GL and SDL so the test target leaves
+// them out. Debug mode stays off in the tests, so no collider debug entity is ever made
+Debug debugging;
+const float WorldSystem::TILE_SIZE = 100.f;
+
+Entity createColliderDebug(vec2 position, vec2 scale, DIFFUSE_ID diffuse_id, vec3 color, float transparency, vec2 offset)
+{
+	assert(false && "Debug mode is off in the tests");
+	return Entity();
+}
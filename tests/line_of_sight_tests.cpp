@@ -0,0 +1,85 @@
+// internal
+#include "tests.hpp"
+#include "line_of_sight.hpp"
+#include "world_init.hpp"
+
+// Walks the ray through every entity near it, which is what LineOfSight replaced
+bool is_clear_reference(vec2 line_start, vec2 line_end)
+{
+	bool is_line_clear = true;
+	SpatialGrid::getInstance().for_each_on_ray(line_start, line_end, [&](Entity entity_other) {
+		Motion& motion_other = registry.motions.get(entity_other);
+		if (motion_other.type_mask == OBSTACLE_MASK) {
+			vec2 is_colliding = is_circle_line_colliding(motion_other.position, motion_other.radius + 10.f, line_start, line_end);
+			is_line_clear &= is_colliding.x == 0.f && is_colliding.y == 0.f;
+		}
+		return is_line_clear;
+	});
+	return is_line_clear;
+}
+
+// 200 enemies closing in on a wandering player through obstacles and a crowd of beings, asked for like AISystem does:
+// one answer_batch() per tick, then is_clear() per enemy. Both that and is_clear_uncached() must match the reference
+int test_line_of_sight()
+{
+	int num_mismatches = 0;
+	double optimized_us = 0, uncached_us = 0, reference_us = 0;
+	ivec2 grid_size = { 60, 40 };
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	spatial_grid.resize(grid_size);
+	LineOfSight line_of_sight;
+	line_of_sight.resize(grid_size);
+	vec2 room_size = vec2(grid_size) * (float)spatial_grid.cell_size;
+	auto add_to_grid = [&](uint32 type_mask, float radius) {
+		Entity entity;
+		Motion& motion = registry.motions.emplace(entity);
+		motion.type_mask = type_mask;
+		motion.position = { random_float(0.f, room_size.x), random_float(0.f, room_size.y) };
+		motion.radius = radius;
+		motion.cell_coords = spatial_grid.get_grid_cell_coords(motion.position);
+		motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, entity);
+		return entity;
+	};
+	for (int i = 0; i < 150; i++) { add_to_grid(OBSTACLE_MASK, random_float(20.f, 45.f)); }
+	for (int i = 0; i < 2000; i++) { add_to_grid(BEING_MASK, 20.f); } // Don't block, but every ray walks past them
+	line_of_sight.mark_occluders_changed();
+
+	std::vector<LineOfSight::Query> queries;
+	for (int i = 0; i < 200; i++) {
+		queries.push_back({ Entity(), { random_float(0.f, room_size.x), random_float(0.f, room_size.y) }, vec2(0.f) });
+	}
+	vec2 player_position = room_size / 2.f;
+	std::vector<bool> are_clear(queries.size());
+	for (int tick = 0; tick < 200; tick++) {
+		player_position = clamp(player_position + vec2(random_float(-10.f, 10.f), random_float(-10.f, 10.f)), vec2(0.f),
+			room_size - 1.f);
+		for (LineOfSight::Query& query : queries) {
+			query.line_start += normalize(player_position - query.line_start) * 3.f;
+			query.line_end = player_position;
+		}
+		auto start = Clock::now();
+		line_of_sight.answer_batch(queries);
+		for (uint i = 0; i < queries.size(); i++) {
+			are_clear[i] = line_of_sight.is_clear(queries[i].asker, queries[i].line_start, queries[i].line_end);
+		}
+		optimized_us += elapsed_us(start);
+		for (uint i = 0; i < queries.size(); i++) {
+			const LineOfSight::Query& query = queries[i];
+			start = Clock::now();
+			bool is_clear_uncached = line_of_sight.is_clear_uncached(query.line_start, query.line_end);
+			uncached_us += elapsed_us(start);
+			start = Clock::now();
+			bool is_clear_expected = is_clear_reference(query.line_start, query.line_end);
+			reference_us += elapsed_us(start);
+			num_mismatches += (are_clear[i] != is_clear_expected) + (is_clear_uncached != is_clear_expected);
+		}
+	}
+	int num_failed = check("Line of sight", num_mismatches, optimized_us, reference_us);
+	printf("%-28s uncached: %.0fus  lines tested: %u / %u\n", "", uncached_us, line_of_sight.num_lines_tested,
+		line_of_sight.num_queries);
+
+	for (LineOfSight::Query& query : queries) { Entity::release(query.asker); }
+	registry.clear_all_components();
+	spatial_grid.clear_all_cells();
+	return num_failed;
+}
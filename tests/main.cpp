@@ -0,0 +1,72 @@
+// internal
+#include "tests.hpp"
+#include "job_system.hpp"
+
+#include <cstdlib>
+#include <new>
+
+std::mt19937 rng(7);
+
+float random_float(float low, float high)
+{
+	return std::uniform_real_distribution<float>(low, high)(rng);
+}
+
+int random_int(int high)
+{
+	return (int)(rng() % (uint)high);
+}
+
+double elapsed_us(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+std::atomic<uint> num_allocations = 0;
+
+// Replaces the global operator new (and so new[]) to count allocations, the matching deletes free what malloc gave
+void* operator new(size_t size)
+{
+	num_allocations++;
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (ptr == nullptr) throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+int check(const char* name, int num_mismatches, double optimized_us, double reference_us)
+{
+	printf("%-28s %s  mismatches: %d  optimized: %.0fus  reference: %.0fus\n", name, (num_mismatches == 0) ? "OK  " : "FAIL",
+		num_mismatches, optimized_us, reference_us);
+	return (num_mismatches == 0) ? 0 : 1;
+}
+
+int main()
+{
+	JobSystem::getInstance().init();
+	int num_failed = 0;
+	num_failed += test_inline_vector();
+	num_failed += test_component_lookup();
+	num_failed += test_view_iteration();
+	num_failed += test_registry_clear();
+	num_failed += test_circle_lanes();
+	num_failed += test_polygon_edges();
+	num_failed += test_crowded_cells();
+	num_failed += test_query_allocations();
+	num_failed += test_pathfinder_rooms();
+	num_failed += test_pathfinder_hierarchy();
+	num_failed += test_line_of_sight();
+	num_failed += test_particle_integrate();
+	num_failed += test_physics_determinism();
+	num_failed += test_physics_scaling();
+	return num_failed;
+}
@@ -0,0 +1,139 @@
+// internal
+#include "tests.hpp"
+#include "pathfinder.hpp"
+#include "../ext/pathfinder/AStar.hpp"
+#include "../ext/rapidjson/document.h"
+#include "../ext/rapidjson/filereadstream.h"
+
+#include <algorithm>
+#include <filesystem>
+
+const int HIERARCHY_MIN_DISTANCE = 20; // See pathfinder.cpp, shorter paths never go through the hierarchy
+
+// Both sides of a comparison against the vendored AStar::Generator that Pathfinder replaced
+struct PathfinderPair
+{
+	ivec2 grid_size;
+	Pathfinder pathfinder;
+	AStar::Generator generator;
+	uint reference_length = 0; // Of the last compare_path()
+
+	PathfinderPair(ivec2 grid_size) : grid_size(grid_size) {
+		pathfinder.resize(grid_size);
+		generator.setWorldSize({ grid_size.x, grid_size.y });
+		generator.setHeuristic(AStar::Heuristic::euclidean);
+	}
+	void add_collision(ivec2 cell_coords) {
+		pathfinder.add_collision(cell_coords);
+		generator.addCollision({ cell_coords.x, cell_coords.y });
+	}
+	// Mismatches of one query. Both must agree on reaching the goal, and the path must go one free tile at a time.
+	// is_exact: the path must be as short as AStar's, otherwise only not shorter
+	int compare_path(ivec2 start, ivec2 goal, bool is_exact, std::vector<ivec2>& path, double& optimized_us, double& reference_us) {
+		auto start_time = Clock::now();
+		pathfinder.find_path(start, goal, path);
+		optimized_us += elapsed_us(start_time);
+		start_time = Clock::now();
+		AStar::CoordinateList reference_path = generator.findPath({ goal.x, goal.y }, { start.x, start.y }); // Goal first
+		reference_us += elapsed_us(start_time);
+		reference_length = (uint)reference_path.size();
+
+		bool is_reached = path.back() == goal;
+		bool is_reached_reference = reference_path.front().x == start.x && reference_path.front().y == start.y
+			&& reference_path.back().x == goal.x && reference_path.back().y == goal.y;
+		if (is_reached != is_reached_reference) { return 1; }
+		if (!is_reached) { return 0; }
+		int num_mismatches = (is_exact) ? path.size() != reference_path.size() : path.size() < reference_path.size();
+		for (uint i = 1; i < path.size(); i++) {
+			num_mismatches += abs(path[i].x - path[i - 1].x) + abs(path[i].y - path[i - 1].y) != 1;
+			num_mismatches += i + 1 < path.size() && pathfinder.is_blocked(path[i]);
+		}
+		return num_mismatches;
+	}
+};
+
+// Every room in data/rooms, blocked where createRoom() would block it: each tree blocks the tile it stands on. Every free
+// tile paths to the player spawn like the enemies do, plus random pairs of free tiles
+int test_pathfinder_rooms()
+{
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	std::vector<ivec2> path;
+	uint num_rooms = 0, num_queries = 0;
+	std::vector<std::string> room_paths; // Sorted so the random queries are the same every run
+	for (const auto& file : std::filesystem::directory_iterator(std::string(PROJECT_SOURCE_DIR) + "data/rooms")) {
+		if (file.path().extension() == ".json") { room_paths.push_back(file.path().string()); }
+	}
+	std::sort(room_paths.begin(), room_paths.end());
+	for (const std::string& room_path : room_paths) {
+		FILE* fp = fopen(room_path.c_str(), "rb");
+		char read_buffer[8192];
+		rapidjson::FileReadStream input_stream(fp, read_buffer, sizeof(read_buffer));
+		rapidjson::Document dom;
+		dom.ParseStream(input_stream);
+		fclose(fp);
+
+		PathfinderPair pair({ dom["grid_size"]["num_cols"].GetInt(), dom["grid_size"]["num_rows"].GetInt() });
+		if (dom["obstacles"].HasMember("tree")) {
+			const rapidjson::Value& trees = dom["obstacles"]["tree"]["pos"];
+			for (rapidjson::SizeType i = 0; i < trees.Size(); i++) {
+				pair.add_collision({ trees[i]["x"].GetInt(), trees[i]["y"].GetInt() });
+			}
+		}
+		ivec2 player_spawn = { dom["player_spawn"]["x"].GetInt(), dom["player_spawn"]["y"].GetInt() };
+		std::vector<ivec2> free_tiles;
+		for (int X = 0; X < pair.grid_size.x; X++) {
+			for (int Y = 0; Y < pair.grid_size.y; Y++) {
+				if (!pair.pathfinder.is_blocked({ X, Y })) { free_tiles.push_back({ X, Y }); }
+			}
+		}
+		auto compare_path = [&](ivec2 start, ivec2 goal) {
+			bool is_exact = abs(start.x - goal.x) + abs(start.y - goal.y) < HIERARCHY_MIN_DISTANCE;
+			num_mismatches += pair.compare_path(start, goal, is_exact, path, optimized_us, reference_us);
+			num_queries++;
+		};
+		if (!pair.pathfinder.is_blocked(player_spawn)) {
+			for (ivec2 tile : free_tiles) { compare_path(tile, player_spawn); }
+		}
+		for (int query = 0; query < 200; query++) {
+			compare_path(free_tiles[random_int((int)free_tiles.size())], free_tiles[random_int((int)free_tiles.size())]);
+		}
+		num_rooms++;
+	}
+	int num_failed = check("Pathfinder vs AStar (rooms)", num_mismatches, optimized_us, reference_us);
+	printf("%-28s rooms: %u  queries: %u\n", "", num_rooms, num_queries);
+	return num_failed + (num_rooms == 0);
+}
+
+// Random maps bigger than the rooms, so long paths go through the cluster hierarchy. Those may be a little longer than
+// AStar's, but never shorter and never more than MAX_EXTRA_LENGTH longer on average
+int test_pathfinder_hierarchy()
+{
+	const float MAX_EXTRA_LENGTH = 0.1f;
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	std::vector<ivec2> path;
+	uint path_length = 0, path_length_reference = 0;
+	for (int map = 0; map < 40; map++) {
+		PathfinderPair pair({ 30 + random_int(50), 30 + random_int(50) });
+		for (int i = 0; i < pair.grid_size.x * pair.grid_size.y / 5; i++) {
+			pair.add_collision({ random_int(pair.grid_size.x), random_int(pair.grid_size.y) });
+		}
+		for (int query = 0; query < 30; query++) {
+			ivec2 start = { random_int(pair.grid_size.x), random_int(pair.grid_size.y) };
+			ivec2 goal = { random_int(pair.grid_size.x), random_int(pair.grid_size.y) };
+			bool is_long = abs(start.x - goal.x) + abs(start.y - goal.y) >= HIERARCHY_MIN_DISTANCE;
+			if (!is_long || pair.pathfinder.is_blocked(start) || pair.pathfinder.is_blocked(goal)) { continue; }
+			num_mismatches += pair.compare_path(start, goal, false, path, optimized_us, reference_us);
+			if (path.back() == goal) {
+				path_length += (uint)path.size();
+				path_length_reference += pair.reference_length;
+			}
+		}
+	}
+	float extra_length = (float)path_length / (float)max(path_length_reference, 1u) - 1.f;
+	num_mismatches += extra_length > MAX_EXTRA_LENGTH;
+	int num_failed = check("Pathfinder hierarchy", num_mismatches, optimized_us, reference_us);
+	printf("%-28s extra path length: %.1f%%\n", "", extra_length * 100.f);
+	return num_failed;
+}
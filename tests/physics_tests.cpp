@@ -0,0 +1,248 @@
+// internal
+#include "tests.hpp"
+#include "physics_system.hpp"
+#include "job_system.hpp"
+#include "world_init.hpp"
+
+#include <cstring>
+#include <optional>
+
+const uint PHYSICS_STEPS = 120;
+const float PHYSICS_STEP_MS = 1000.f / 120.f;
+
+// A crowded 40x40 room: obstacles, beings walking every which way, projectiles and falling particles. The entities are
+// made once and every run reuses them, since the physics step orders collision pairs by entity id
+struct PhysicsRoom
+{
+	std::vector<Entity> entities;
+	Entity room_entity;
+	Entity camera_entity;
+	Entity player_entity;
+
+	PhysicsRoom() : entities(4000) {}
+
+	void build() {
+		std::mt19937 room_rng(11); // Its own, so every build is the same
+		auto random = [&](float low, float high) { return std::uniform_real_distribution<float>(low, high)(room_rng); };
+		ivec2 grid_size = { 40, 40 };
+		SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+		spatial_grid.resize(grid_size);
+		registry.rooms.emplace(room_entity).grid_size = grid_size;
+		registry.cameras.emplace(camera_entity);
+		vec2 room_size = vec2(grid_size) * (float)spatial_grid.cell_size;
+
+		auto add_motion = [&](Entity entity, uint32 type_mask, float radius, float max_speed) -> Motion& {
+			Motion& motion = registry.motions.emplace(entity);
+			motion.position = { random(50.f, room_size.x - 50.f), random(50.f, room_size.y - 50.f) };
+			motion.last_position = motion.position;
+			motion.type_mask = type_mask;
+			motion.radius = radius;
+			motion.scale = vec2(4.f * radius);
+			motion.max_speed = max_speed;
+			motion.moving = max_speed > 0.f;
+			if (motion.moving) { registry.awakeMotions.emplace(entity); }
+			if (type_mask != PARTICLE_MASK) {
+				motion.cell_coords = spatial_grid.get_grid_cell_coords(motion.position);
+				motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, entity);
+			}
+			return motion;
+		};
+		Motion& player_motion = add_motion(player_entity, PLAYER_MASK | BEING_MASK, 30.f, 500.f);
+		player_motion.move_direction = { 1.f, 0.f };
+		registry.players.emplace(player_entity, PLAYER_CHARACTER::HANSEL);
+		registry.spriteSheets.emplace(player_entity, 1, std::vector<std::vector<int>>{ { 0 }, { 0 } },
+			std::vector<float>{ 100.f, 100.f });
+		for (uint i = 0; i < entities.size(); i++) {
+			Entity entity = entities[i];
+			if (i < 150) {
+				add_motion(entity, OBSTACLE_MASK, random(20.f, 45.f), 0.f);
+			} else if (i < 3000) {
+				Motion& motion = add_motion(entity, BEING_MASK, random(15.f, 30.f), random(100.f, 200.f));
+				float angle = random(0.f, 6.2831853f);
+				motion.move_direction = { cos(angle), sin(angle) };
+			} else if (i < 3300) {
+				Motion& motion = add_motion(entity, PROJECTILE_MASK, 10.f, 800.f);
+				float angle = random(0.f, 6.2831853f);
+				motion.velocity = vec2(cos(angle), sin(angle)) * 800.f;
+				motion.friction = 1.f;
+				motion.sprite_offset = { 0.f, -20.f };
+			} else {
+				Motion& motion = add_motion(entity, PARTICLE_MASK, 5.f, 100.f);
+				motion.velocity = { random(-100.f, 100.f), random(-100.f, 100.f) };
+				motion.sprite_offset_velocity = random(50.f, 150.f);
+				motion.sprite_offset = { 0.f, -random(0.f, 50.f) };
+			}
+		}
+	}
+
+	// Only the containers build() and the physics step fill, so the entities stay alive for the next build()
+	void clear() {
+		registry.motions.clear();
+		registry.awakeMotions.clear();
+		registry.collisions.clear();
+		registry.tempEffects.clear();
+		registry.rooms.clear();
+		registry.cameras.clear();
+		registry.players.clear();
+		registry.spriteSheets.clear();
+		SpatialGrid::getInstance().clear_all_cells();
+	}
+
+	// Runs the steps on num_threads threads. Fills the motions' positions and velocities after the last step and every
+	// collision found on the way, in order. Returns the time the steps took
+	double run(uint num_threads, std::vector<vec2>& state, std::vector<uint>& collisions) {
+		JobSystem::getInstance().init(num_threads);
+		build();
+		PhysicsSystem physics;
+		auto start = Clock::now();
+		for (uint step = 0; step < PHYSICS_STEPS; step++) {
+			physics.step(PHYSICS_STEP_MS);
+			for (uint i = 0; i < registry.collisions.size(); i++) { // WorldSystem::handle_collisions() would clear these
+				collisions.push_back((unsigned int)Entity(registry.collisions.entities[i]));
+				collisions.push_back((unsigned int)Entity(registry.collisions.components[i].other));
+			}
+			registry.collisions.clear();
+		}
+		double run_us = elapsed_us(start);
+		for (Entity entity : entities) {
+			Motion& motion = registry.motions.get(entity);
+			state.push_back(motion.position);
+			state.push_back(motion.velocity);
+		}
+		clear();
+		return run_us;
+	}
+
+	~PhysicsRoom() {
+		for (Entity entity : entities) { Entity::release(entity); }
+		Entity::release(room_entity);
+		Entity::release(camera_entity);
+		Entity::release(player_entity);
+	}
+};
+
+// Motion as it was before the hot fields were moved to the front and the child list to MotionLinks
+struct OldMotion {
+	uint32 type_mask = 0;
+	bool moving = false;
+	bool is_culled = false;
+	vec2 move_direction = { 0,0 };
+	vec2 look_direction = { 1,0 };
+	vec2 position = { 0,0 };
+	vec2 velocity = { 0,0 };
+	float angular_velocity = 0.f;
+	float radius = 40.f;
+	bool angled = false;
+	float angle = 0.f;
+	float accel_rate = 600.f;
+	float friction = 0.7f;
+	float max_speed = 50.f;
+	float mass = 100.f;
+	float current_speed = 0;
+	vec2 scale = { 1.f,1.f };
+	vec2 sprite_offset = { 0,0 };
+	vec3 sprite_normal = { 0,cos(0.2),sin(0.2) };
+	float sprite_offset_velocity = 0.f;
+	float gravity_multiplier = 1.f;
+	vec3 forces = { 0,0,0 };
+	ivec2 cell_coords = { INT_MAX, INT_MAX };
+	int cell_index = INT_MAX;
+	bool checked_collisions = false;
+	std::vector<Entity> children = {};
+	std::optional<Entity> parent = std::nullopt;
+};
+
+// integrate_motions() against the integration the old per-motion loop did on OldMotion, for 50000 flying particles
+// over 100 steps. Both must end with the same positions
+int test_particle_integrate()
+{
+	const uint NUM_PARTICLES = 50000;
+	const float STEP_SECONDS = PHYSICS_STEP_MS / 1000.f;
+	const vec2 ROOM_SIZE = { 4000.f, 4000.f };
+	const float CLAMP_INSET = 10.f;
+	std::vector<OldMotion> old_motions(NUM_PARTICLES);
+	std::vector<Entity> entities(NUM_PARTICLES);
+	for (uint i = 0; i < NUM_PARTICLES; i++) {
+		Motion& motion = registry.motions.emplace(entities[i]);
+		registry.awakeMotions.emplace(entities[i]);
+		motion.type_mask = PARTICLE_MASK;
+		motion.moving = true;
+		motion.position = { random_float(0.f, ROOM_SIZE.x), random_float(0.f, ROOM_SIZE.y) };
+		motion.velocity = { random_float(-100.f, 100.f), random_float(-100.f, 100.f) };
+		OldMotion& old_motion = old_motions[i];
+		old_motion.type_mask = motion.type_mask;
+		old_motion.moving = motion.moving;
+		old_motion.position = motion.position;
+		old_motion.velocity = motion.velocity;
+	}
+
+	double optimized_us = 0, reference_us = 0;
+	auto integrate = [&]() {
+		auto start = Clock::now();
+		integrate_motions(STEP_SECONDS, ROOM_SIZE, CLAMP_INSET);
+		optimized_us += elapsed_us(start);
+	};
+	auto integrate_reference = [&]() {
+		auto start = Clock::now();
+		for (uint i = 0; i < old_motions.size(); i++) {
+			OldMotion& motion = old_motions[i];
+			Entity entity = entities[i];
+			if (!motion.moving) { continue; }
+			if (registry.bezierCurves.has(entity)) { continue; } // None here, but the old loop asked every motion
+			motion.position += motion.velocity * STEP_SECONDS;
+			if (motion.type_mask & BEING_MASK) {
+				motion.position.x = clamp(motion.position.x, CLAMP_INSET, ROOM_SIZE.x - CLAMP_INSET);
+				motion.position.y = clamp(motion.position.y, CLAMP_INSET, ROOM_SIZE.y - CLAMP_INSET);
+			}
+		}
+		reference_us += elapsed_us(start);
+	};
+	for (int step = 0; step < 100; step++) { // Taking turns going first, like test_view_iteration()
+		if (step % 2 == 0) { integrate(); integrate_reference(); }
+		else { integrate_reference(); integrate(); }
+	}
+	int num_mismatches = 0;
+	for (uint i = 0; i < NUM_PARTICLES; i++) {
+		num_mismatches += registry.motions.get(entities[i]).position != old_motions[i].position;
+	}
+	int num_failed = check("Particle integrate (50k)", num_mismatches, optimized_us, reference_us);
+	printf("%-28s motion: %u bytes, was %u\n", "", (uint)sizeof(Motion), (uint)sizeof(OldMotion));
+	registry.clear_all_components();
+	return num_failed;
+}
+
+// Chunks are split and merged the same way for any thread count (see job_system.hpp), so the physics step must give
+// bit for bit the same motions and collisions on 1 and 8 threads
+int test_physics_determinism()
+{
+	PhysicsRoom room;
+	std::vector<vec2> state, state_threaded;
+	std::vector<uint> collisions, collisions_threaded;
+	double single_us = room.run(1, state, collisions);
+	double threaded_us = room.run(8, state_threaded, collisions_threaded);
+	int num_mismatches = 0;
+	for (uint i = 0; i < state.size(); i++) {
+		num_mismatches += memcmp(&state[i], &state_threaded[i], sizeof(vec2)) != 0;
+	}
+	num_mismatches += collisions != collisions_threaded;
+	int num_failed = check("Physics 1 vs 8 threads", num_mismatches, threaded_us, single_us);
+	printf("%-28s collisions: %u\n", "", (uint)collisions.size() / 2);
+	JobSystem::getInstance().init();
+	return num_failed;
+}
+
+// Not a check, only prints how the physics step scales with the thread count
+int test_physics_scaling()
+{
+	PhysicsRoom room;
+	std::vector<vec2> state;
+	std::vector<uint> collisions;
+	for (uint num_threads = 1; num_threads <= 8; num_threads *= 2) {
+		state.clear();
+		collisions.clear();
+		double run_us = room.run(num_threads, state, collisions);
+		printf("%-28s %u threads: %.2fms per step\n", "Physics scaling", num_threads, run_us / 1000.0 / PHYSICS_STEPS);
+	}
+	JobSystem::getInstance().init();
+	return 0;
+}
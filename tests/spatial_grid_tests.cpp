@@ -0,0 +1,228 @@
+// internal
+#include "tests.hpp"
+#include "spatial_grid.hpp"
+#include "physics_system.hpp"
+#include "world_init.hpp"
+
+// are_circles_colliding() against the per-pair test, with counts that leave a remainder after the SIMD blocks
+int test_circle_lanes()
+{
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	std::vector<float> x1, y1, x2, y2, combined_radii;
+	std::vector<uint8_t> is_colliding, is_colliding_reference;
+	for (uint count = 0; count < 2000; count += 1 + count / 4) {
+		x1.resize(count); y1.resize(count); x2.resize(count); y2.resize(count); combined_radii.resize(count);
+		is_colliding.resize(count); is_colliding_reference.resize(count);
+		for (uint i = 0; i < count; i++) {
+			x1[i] = random_float(0.f, 500.f); y1[i] = random_float(0.f, 500.f);
+			x2[i] = x1[i] + random_float(-60.f, 60.f); y2[i] = y1[i] + random_float(-60.f, 60.f);
+			combined_radii[i] = random_float(5.f, 60.f);
+		}
+		auto start = Clock::now();
+		are_circles_colliding(count, x1.data(), y1.data(), x2.data(), y2.data(), combined_radii.data(), is_colliding.data());
+		optimized_us += elapsed_us(start);
+		start = Clock::now();
+		for (uint i = 0; i < count; i++) {
+			is_colliding_reference[i] = is_circle_colliding({ x1[i], y1[i] }, combined_radii[i] / 2.f, { x2[i], y2[i] }, combined_radii[i] / 2.f);
+		}
+		reference_us += elapsed_us(start);
+		for (uint i = 0; i < count; i++) {
+			num_mismatches += is_colliding[i] != is_colliding_reference[i];
+		}
+	}
+	return check("Circle pair lanes", num_mismatches, optimized_us, reference_us);
+}
+
+// circle_edges_push() and is_point_within_edges() against going through the edges one by one
+int test_polygon_edges()
+{
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	for (int polygon = 0; polygon < 200; polygon++) {
+		// A star shaped polygon around the origin, counter-clockwise
+		std::vector<Edge> world_edges;
+		uint num_vertices = 3 + random_int(30);
+		std::vector<vec2> vertices;
+		for (uint i = 0; i < num_vertices; i++) {
+			float angle = 2.f * (float)M_PI * (float)i / (float)num_vertices;
+			vertices.push_back(random_float(100.f, 300.f) * vec2(cos(angle), sin(angle)));
+		}
+		for (uint i = 0; i < num_vertices; i++) {
+			world_edges.push_back({ vertices[i], vertices[(i + 1) % num_vertices], random_int(5) != 0 });
+		}
+		PolygonEdges edges;
+		for (const Edge& edge : world_edges) { edges.push_back(edge); }
+
+		for (int query = 0; query < 200; query++) {
+			vec2 position = { random_float(-350.f, 350.f), random_float(-350.f, 350.f) };
+			float radius = random_float(5.f, 60.f);
+			vec2 velocity = { random_float(-200.f, 200.f), random_float(-200.f, 200.f) };
+
+			auto start = Clock::now();
+			vec2 push_velocity = circle_edges_push(edges, 0, edges.size(), position, radius, velocity);
+			bool is_within = is_point_within_edges(edges, 0, edges.size(), position);
+			optimized_us += elapsed_us(start);
+
+			start = Clock::now();
+			vec2 push_velocity_reference = { 0.f, 0.f };
+			int num_intersections = 0;
+			for (const Edge& edge : world_edges) {
+				if (edge.is_collidable) {
+					push_velocity_reference += is_circle_line_colliding(position, radius, velocity + push_velocity_reference,
+						edge.vertex1, edge.vertex2);
+				}
+				if ((edge.vertex1.y > position.y) != (edge.vertex2.y > position.y)
+					&& position.x < edge.vertex1.x + (position.y - edge.vertex1.y) * (edge.vertex2.x - edge.vertex1.x) / (edge.vertex2.y - edge.vertex1.y)) {
+					num_intersections++;
+				}
+			}
+			reference_us += elapsed_us(start);
+			// The edge data is precomputed once instead of per test, so only rounding may differ
+			num_mismatches += length(push_velocity - push_velocity_reference) > 1e-3f * (1.f + length(push_velocity_reference));
+			num_mismatches += is_within != ((num_intersections & 1) == 1);
+		}
+	}
+	return check("Circle-polygon edges", num_mismatches, optimized_us, reference_us);
+}
+
+// 10000 beings crowding 2x2 cells (800 to 1000 on both axes) and jostling across their edges for 30 steps. Cells have
+// no entity cap, so every being must stay findable at its cell_index, and counting each cell around the crowd with
+// for_each_in_rect() must match counting the beings whose position is in it
+int test_crowded_cells()
+{
+	const uint NUM_BEINGS = 10000;
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0, move_us = 0;
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	spatial_grid.resize({ 20, 20 });
+	PhysicsSystem physics;
+	std::vector<Entity> entities(NUM_BEINGS);
+	for (Entity entity : entities) {
+		Motion& motion = registry.motions.emplace(entity);
+		motion.type_mask = BEING_MASK;
+		motion.radius = 10.f;
+		motion.position = { random_float(800.f, 1000.f), random_float(800.f, 1000.f) };
+		motion.cell_coords = spatial_grid.get_grid_cell_coords(motion.position);
+		motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, entity);
+	}
+	uint max_cell_size = 0;
+	for (int step = 0; step < 30; step++) {
+		auto start = Clock::now();
+		for (Entity entity : entities) {
+			Motion& motion = registry.motions.get(entity);
+			motion.position = clamp(motion.position + vec2(random_float(-15.f, 15.f), random_float(-15.f, 15.f)), vec2(790.f),
+				vec2(1009.f));
+			physics.update_motion_cells(entity, motion);
+		}
+		move_us += elapsed_us(start);
+		for (Entity entity : entities) {
+			const Motion& motion = registry.motions.get(entity);
+			const std::vector<Entity>& cell_entities = spatial_grid.get_cell(motion.cell_coords).entities;
+			num_mismatches += motion.cell_index < 0 || motion.cell_index >= (int)cell_entities.size()
+				|| cell_entities[motion.cell_index] != entity;
+		}
+		for (int X = 7; X <= 10; X++) {
+			for (int Y = 7; Y <= 10; Y++) {
+				start = Clock::now();
+				uint num_found = 0;
+				spatial_grid.for_each_in_rect({ X, Y }, { X, Y }, [&](Entity entity) { num_found++; });
+				optimized_us += elapsed_us(start);
+				start = Clock::now();
+				uint num_expected = 0;
+				for (Entity entity : entities) {
+					num_expected += spatial_grid.get_grid_cell_coords(registry.motions.get(entity).position) == ivec2(X, Y);
+				}
+				reference_us += elapsed_us(start);
+				num_mismatches += num_found != num_expected;
+				max_cell_size = max(max_cell_size, num_found);
+			}
+		}
+	}
+	int num_failed = check("Crowded cells", num_mismatches, optimized_us, reference_us);
+	printf("%-28s most in one cell: %u  moving: %.0fus\n", "", max_cell_size, move_us);
+	registry.clear_all_components();
+	spatial_grid.clear_all_cells();
+	return num_failed;
+}
+
+// A crowded 40x40 room queried like a frame does: around every light and enemy, along lines of sight and projectile
+// paths. Once the caller's buffer has grown to fit, neither the callback queries nor the ones filling that buffer may
+// allocate, and all must find the same entities as the vector returning versions
+int test_query_allocations()
+{
+	int num_mismatches = 0;
+	double optimized_us = 0, reference_us = 0;
+	SpatialGrid& spatial_grid = SpatialGrid::getInstance();
+	spatial_grid.resize({ 40, 40 });
+	vec2 room_size = vec2(spatial_grid.grid_size) * (float)spatial_grid.cell_size;
+	for (int i = 0; i < 5000; i++) {
+		Entity entity;
+		Motion& motion = registry.motions.emplace(entity);
+		motion.type_mask = BEING_MASK;
+		motion.position = { random_float(0.f, room_size.x), random_float(0.f, room_size.y) };
+		motion.cell_coords = spatial_grid.get_grid_cell_coords(motion.position);
+		motion.cell_index = spatial_grid.add_entity_to_cell(motion.cell_coords, entity);
+	}
+	for (int i = 0; i < 30; i++) { // Polygons and big obstacles, in the coarse level
+		Entity entity;
+		registry.motions.emplace(entity).cell_index = SpatialGrid::LARGE_ENTITY_INDEX;
+		vec2 position = { random_float(0.f, room_size.x), random_float(0.f, room_size.y) };
+		spatial_grid.add_large_entity(entity, get_bbox(position, vec2(random_float(100.f, 600.f))));
+	}
+	struct Query {
+		vec2 line_start;
+		vec2 line_end;
+		float radius;
+	};
+	std::vector<Query> queries;
+	for (int i = 0; i < 500; i++) {
+		vec2 line_start = { random_float(0.f, room_size.x), random_float(0.f, room_size.y) };
+		queries.push_back({ line_start, clamp(line_start + vec2(random_float(-800.f, 800.f), random_float(-800.f, 800.f)),
+			vec2(0.f), room_size - 1.f), random_float(50.f, 400.f) });
+	}
+
+	std::vector<Entity> entities_found;
+	uint num_allocations_per_frame = 0, num_allocations_per_frame_reference = 0;
+	for (int frame = 0; frame < 10; frame++) { // The first grows entities_found, the others must not allocate
+		uint first_num_allocations = num_allocations;
+		auto start = Clock::now();
+		uint num_found = 0, num_cells = 0;
+		for (const Query& query : queries) {
+			ivec2 center_cell = spatial_grid.get_grid_cell_coords(query.line_start);
+			spatial_grid.for_each_in_radius(center_cell, query.radius, [&](Entity entity) { num_found++; });
+			spatial_grid.for_each_on_ray(query.line_start, query.line_end, [&](Entity entity) { num_found++; });
+			spatial_grid.for_each_cell_on_line(query.line_start, query.line_end, [&](ivec2 cell_coords) { num_cells++; });
+		}
+		optimized_us += elapsed_us(start);
+		uint num_found_buffered = 0;
+		for (const Query& query : queries) {
+			spatial_grid.query_radius(spatial_grid.get_grid_cell_coords(query.line_start), query.radius, entities_found);
+			num_found_buffered += (uint)entities_found.size();
+			spatial_grid.query_ray_cast(query.line_start, query.line_end, entities_found);
+			num_found_buffered += (uint)entities_found.size();
+		}
+		num_allocations_per_frame = num_allocations - first_num_allocations;
+		num_mismatches += frame > 0 && num_allocations_per_frame > 0;
+
+		first_num_allocations = num_allocations;
+		start = Clock::now();
+		uint num_found_reference = 0, num_cells_reference = 0;
+		for (const Query& query : queries) {
+			ivec2 center_cell = spatial_grid.get_grid_cell_coords(query.line_start);
+			num_found_reference += (uint)spatial_grid.query_radius(center_cell, query.radius).size();
+			num_found_reference += (uint)spatial_grid.query_ray_cast(query.line_start, query.line_end).size();
+			num_cells_reference += (uint)spatial_grid.raster_line(query.line_start, query.line_end).size();
+		}
+		reference_us += elapsed_us(start);
+		num_allocations_per_frame_reference = num_allocations - first_num_allocations;
+		num_mismatches += num_found != num_found_reference || num_found_buffered != num_found_reference
+			|| num_cells != num_cells_reference;
+	}
+	int num_failed = check("Query allocations", num_mismatches, optimized_us, reference_us);
+	printf("%-28s allocations per frame: %u, vector returning: %u\n", "", num_allocations_per_frame,
+		num_allocations_per_frame_reference);
+	registry.clear_all_components();
+	spatial_grid.clear_all_cells();
+	return num_failed;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Checks that the optimized ECS, collision, pathfinding and line of sight code gives the same answers as the
+// straightforward versions it replaced, and times both. Only uses the sources that don't need GL or SDL, see
+// CMakeLists.txt. Each test returns its number of failed checks, main() returns their sum
+#include "common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <random>
+
+using Clock = std::chrono::high_resolution_clock;
+
+extern std::mt19937 rng; // Same seed every run, so a failure can be reproduced
+float random_float(float low, float high);
+int random_int(int high); // In [0, high)
+double elapsed_us(Clock::time_point start);
+extern std::atomic<uint> num_allocations; // Every operator new so far, counted in main.cpp
+
+// Prints one line per check, returns 1 if it failed
+int check(const char* name, int num_mismatches, double optimized_us, double reference_us);
+
+// common_tests.cpp
+int test_inline_vector();
+
+// ecs_tests.cpp
+int test_component_lookup();
+int test_view_iteration();
+int test_registry_clear();
+
+// physics_tests.cpp
+int test_particle_integrate();
+int test_physics_determinism();
+int test_physics_scaling();
+
+// spatial_grid_tests.cpp
+int test_circle_lanes();
+int test_polygon_edges();
+int test_crowded_cells();
+int test_query_allocations();
+
+// pathfinder_tests.cpp
+int test_pathfinder_rooms();
+int test_pathfinder_hierarchy();
+
+// line_of_sight_tests.cpp
+int test_line_of_sight();